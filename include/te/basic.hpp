@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cinttypes>
 #include <bitset>
 #include <vector>
@@ -45,6 +47,10 @@ enum {
   CHAR_ATTR_UNDERLINE,
   CHAR_ATTR_INVERT,
   CHAR_ATTR_CROSSED_OUT,
+  // a double width character, drawn over this cell and the next one
+  CHAR_ATTR_WIDE,
+  // the second cell of a double width character
+  CHAR_ATTR_WIDE_SPACER,
 
 
   // CSI ?0h
@@ -62,13 +68,50 @@ enum {
   CHAR_ATTR_COUNT
 };
 
+// the attributes set by SGR, copied into cells
+constexpr unsigned long CharAttrSGRMask = (1ul << (CHAR_ATTR_CROSSED_OUT + 1)) - 1;
+
+// palette entries after the 256 indexed colors
+enum {
+  PALETTE_DEFAULT_FG = 256,
+  PALETTE_DEFAULT_BG,
+
+  PALETTE_SIZE
+};
+
+// Color of a cell, an index into the palette or a 24 bit RGB value. Resolved by the renderer,
+//  so palette changes do not touch the cells.
+struct CellColor {
+  static constexpr uint32_t rgb_flag = 1u << 24u;
+
+  static constexpr CellColor indexed(uint32_t index) {
+    return CellColor{index};
+  }
+  static constexpr CellColor rgb(uint8_t r, uint8_t g, uint8_t b) {
+    return CellColor{rgb_flag | ((uint32_t) r << 16u) | ((uint32_t) g << 8u) | b};
+  }
+
+  bool is_rgb() const {
+    return value & rgb_flag;
+  }
+  // palette index, or the 0x00rrggbb color if is_rgb()
+  uint32_t index() const {
+    return value & 0xffffffu;
+  }
+  bool operator==(const CellColor &rhs) const {
+    return value == rhs.value;
+  }
+
+  uint32_t value;
+};
+
 struct Char {
   void reset() {
     *this = Char();
   }
   std::string c;
-  Color fg_color = ColorWhite;
-  Color bg_color = ColorBlack; // TODO
+  CellColor fg_color = CellColor::indexed(PALETTE_DEFAULT_FG);
+  CellColor bg_color = CellColor::indexed(PALETTE_DEFAULT_BG);
 
   std::bitset<CHAR_ATTR_COUNT> attr;
 };
@@ -125,6 +168,26 @@ static Color ColorTable256[] = {
     0xffd0d0d0, 0xffdadada, 0xffe4e4e4, 0xffeeeeee
 };
 
+// Colors of the palette indexes, changed with OSC 4, 10 and 11.
+struct Palette {
+  std::array<Color, PALETTE_SIZE> colors;
+  // changed on every change, unique across sessions, renderers rebuild their color tables when it changes
+  uint64_t version = 0;
 
+  static uint64_t next_version() {
+    static std::atomic<uint64_t> version = 0;
+    return version.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  static Palette default_palette() {
+    Palette palette{};
+    for (int i = 0; i < 256; i++) {
+      palette.colors[i] = i < 16 ? ColorTable16[i] : ColorTable256[i];
+    }
+    palette.colors[PALETTE_DEFAULT_FG] = ColorWhite;
+    palette.colors[PALETTE_DEFAULT_BG] = ColorBlack;
+    return palette;
+  }
+};
 
-}
\ No newline at end of file
+}
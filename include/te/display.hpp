@@ -1,46 +1,134 @@
 #pragma once
+#include <atomic>
 #include <bitset>
+#include <chrono>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include <te/basic.hpp>
-#include <te/subprocess.hpp>
-#include <te/tty_input.hpp>
+#include <te/latency_stats.hpp>
+#include <te/session.hpp>
 
 struct SDL_Window;
 struct SDL_Texture;
 struct SDL_Renderer;
+struct SDL_Surface;
 struct _TTF_Font;
 typedef _TTF_Font TTF_Font;
 
 namespace te {
 class Screen;
+class Row;
+struct ScreenSnapshot;
 class FontCache;
+class SoftwareCompositor;
+class LatencyBench;
 class Display {
  public:
   Display(std::ostream &log_stream,
           const std::vector<std::string> &args,
           const std::string &term_env,
           const std::string &font_file_path,
+          const std::vector<std::string> &fallback_font_paths,
           int font_size,
+          size_t glyph_cache_bytes,
           const std::string &background_image_path,
           const std::vector<std::string> &environment_variables,
-          bool use_accleration);
+          bool use_accleration,
+          const std::string &stats_socket_path,
+          const std::string &attach_socket_path = "",
+          bool verbose_log = false);
 
   ~Display();
 
   void loop();
+  // measure n_samples key presses in loop(), which returns after printing the result
+  void enable_latency_bench(int n_samples);
 
-  // child process
-  bool check_child_process();
-  void process_input();
-  void write_pending_input_data(std::vector<uint8_t> &input_buffer);
-  void write_to_tty(std::string_view s) const;
+  // any thread
+  void request_redraw();
+
+  // frame scheduling
+  std::chrono::high_resolution_clock::time_point next_frame_deadline(bool damaged) const;
+  void update_frame_interval();
+
+  // a terminal shown in a pane, with the render state of its frame
+  struct Pane {
+    std::unique_ptr<Session> session;
+    // top left corner of the pane in the window and its size in cells
+    int x = 0, y = 0;
+    int rows = 0, cols = 0;
+    // the snapshot being rendered, and the version of the snapshot rendered last
+    std::shared_ptr<const ScreenSnapshot> frame_snapshot;
+    uint64_t rendered_version = 0;
+    // the composed rows of the last frame, two textures to copy the frame shifted when scrolling
+    SDL_Texture *frame_textures[2] = {nullptr, nullptr};
+    int frame_index = 0;
+    int frame_texture_w = 0, frame_texture_h = 0;
+    // version of each row in the frame, 0 if the row needs to be drawn
+    std::vector<uint64_t> frame_row_versions;
+    int frame_cols = 0;
+    int64_t frame_scroll_offset = 0;
+    bool frame_alternate_screen = false;
+    // the palette and reverse video the cached rows of the pane were rendered with
+    uint64_t lut_palette_version = UINT64_MAX;
+    bool lut_reverse_video = false;
+    // rows the cursor, selection and HUD were drawn over in the last frame, software path
+    std::vector<int> software_overlay_rows;
+  };
+  // The panes of a tab, a leaf holds a pane and a split holds two halves side by side or stacked.
+  struct Split {
+    std::unique_ptr<Pane> pane;
+    std::unique_ptr<Split> first, second;
+    bool side_by_side = false;
+    Split *parent = nullptr;
+  };
+  struct Tab {
+    std::unique_ptr<Split> root;
+    Pane *focused = nullptr;
+  };
+
+  // tabs and panes
+  void new_tab();
+  void split_pane(bool side_by_side);
+  void close_pane(Pane *pane);
+  void switch_tab(size_t index);
+  void focus_next_pane();
+  void open_session(Pane &pane);
+  // place the panes of every tab in the window, and resize their sessions
+  void layout();
+  void layout_split(Split &split, int x, int y, int w, int h);
+  // sessions of the panes on screen publish snapshots, the others only parse
+  void update_visibility();
+  // f(pane) for the panes of split, left to right and top to bottom
+  template <typename F>
+  static void for_each_pane(Split &split, F f) {
+    if (split.pane) {
+      f(*split.pane);
+    } else {
+      for_each_pane(*split.first, f);
+      for_each_pane(*split.second, f);
+    }
+  }
+  static Split *find_split(Split &split, const Pane *pane);
+  Pane *pane_at(int x, int y);
+  Pane &focused_pane() {
+    return *tabs_[active_tab_].focused;
+  }
+  const Pane &focused_pane() const {
+    return *tabs_[active_tab_].focused;
+  }
+  Session &focused_session() {
+    return *focused_pane().session;
+  }
 
   // screen
   void resize(int w, int h);
@@ -48,78 +136,197 @@ class Display {
   // clipboard
   void clear_selection();
   std::string clipboard_copy();
-  void clipboard_paste(std::string_view clipboard_text) const;
 
   // rendering
   void render_chars();
-  void render_background_image();
+  void render_pane(Pane &pane);
+  bool render_row(const Row &row_data, int max_cols);
+  void render_overlay(const Pane &pane, int max_rows, int max_cols);
+  void update_hud(const ScreenSnapshot &snapshot);
+  void render_hud(Pane &pane, int max_rows, int max_cols);
+  // separators between panes and the tab bar
+  void render_layout();
+  // a filled rect and a line of text straight into the window, or into the framebuffer of the software path
+  void draw_rect(int x, int y, int w, int h, Color color);
+  void draw_text(int x, int y, int max_cols, std::string_view text, Color color);
+  // draw_cell(row, col, fg, bg) for every selected cell and the cursor
+  template <typename F>
+  void for_each_overlay_cell(const Pane &pane, int max_rows, int max_cols, F draw_cell);
+  void collect_bg_runs(const Row &row_data, int max_cols, bool skip_clear_color);
+  void collect_shaped_runs(const Row &row_data, int max_cols);
+  static void scroll_frame_row_versions(Pane &pane, int shift);
+  void render_software();
+  void render_pane_software(Pane &pane);
+  bool render_row_software(const Row &row_data, int x, int y, int max_cols);
+  void clear_row_textures();
+  void clear_frame_textures(Pane &pane);
+  void clear_frame_textures();
+  void update_background_layer();
   Color map_color(Color color) const;
 
-  // utility functions
+  // cell colors through the color tables, SGR inverse swaps them
+  Color cell_fg(const Char &c) const {
+    return c.attr.test(CHAR_ATTR_INVERT) ? resolve_color(c.bg_color, 0) : resolve_color(c.fg_color, color_variant(c));
+  }
+  Color cell_bg(const Char &c) const {
+    return c.attr.test(CHAR_ATTR_INVERT) ? resolve_color(c.fg_color, color_variant(c)) : resolve_color(c.bg_color, 0);
+  }
+  Color resolve_color(CellColor color, int variant) const {
+    return color.is_rgb() ? resolve_rgb_color(color, variant) : color_lut_[variant][color.index()];
+  }
+  Color resolve_rgb_color(CellColor color, int variant) const;
+  static int color_variant(const Char &c) {
+    return (c.attr.test(CHAR_ATTR_BOLD) ? COLOR_VARIANT_BOLD : 0) | (c.attr.test(CHAR_ATTR_FAINT) ? COLOR_VARIANT_FAINT : 0);
+  }
+  void update_color_lut(Pane &pane);
+  void update_clear_color(const ScreenSnapshot &snapshot);
 
-  void got_character(std::string c);
+  // utility functions
 
   bool less_than(std::tuple<int, int> lhs, std::tuple<int, int> rhs) const {
-    int n_lhs = std::get<0>(lhs) * max_cols_ + std::get<1>(lhs);
-    int n_rhs = std::get<0>(rhs) * max_cols_ + std::get<1>(rhs);
+    int cols = focused_pane().cols;
+    int n_lhs = std::get<0>(lhs) * cols + std::get<1>(lhs);
+    int n_rhs = std::get<0>(rhs) * cols + std::get<1>(rhs);
     return n_lhs < n_rhs;
   }
 
-  // is target in [start, end]
-  bool in_range(std::tuple<int, int> start, std::tuple<int, int> end, std::tuple<int, int> target) const {
-    int n_target = std::get<0>(target) * max_cols_ + std::get<1>(target);
-    int n_start = std::get<0>(start) * max_cols_ + std::get<1>(start);
-    int n_end = std::get<0>(end) * max_cols_ + std::get<1>(end);
-    return (n_start <= n_target && n_target <= n_end) || (n_end <= n_target && n_target <= n_start);
-  }
-  // x,  y -> row, col
+  // x,  y -> row, col of the focused pane
   std::tuple<int, int> window_to_console(int x, int y) const {
-    return {y / glyph_height_, x / glyph_width_};
+    auto &pane = focused_pane();
+    return {(y - pane.y) / glyph_height_, (x - pane.x) / glyph_width_};
   }
 
-  void log_verbose_input_char(uint32_t c, bool has_color);
-
-  void switch_screen(bool alternate_screen);
-
 
 // private:
 
-  // screens
-  Screen *current_screen_;
-  std::unique_ptr<Screen> default_screen_, alternate_screen_;
+  // tabs of sessions, only the panes of the active tab are rendered.
+  // ctrl+shift: t opens a tab, e and o split side by side and stacked, n focuses the next pane,
+  //  w closes the focused pane, [ and ] switch tabs
+  std::vector<Tab> tabs_;
+  size_t active_tab_ = 0;
+  // panes of the active tab, in the order they are rendered
+  std::vector<Pane*> visible_panes_;
+  // gaps between the panes of the active tab
+  std::vector<std::tuple<int, int, int, int>> separators_;
+  // the whole window needs to be drawn again, software path
+  bool layout_damaged_ = true;
+  // command and environment of new sessions
+  std::vector<std::string> args_;
+  std::vector<std::string> envs_;
+  int sessions_opened_ = 0;
+  // the first session is attached to the server listening here instead of running args_, if not empty
+  std::string attach_socket_path_;
+  // the first session traces every control sequence to the log
+  bool verbose_log_;
+  // discards the log of all sessions but the first
+  std::ostream null_log_stream_{nullptr};
+  // reads, parses and writes the ptys of all sessions
+  std::unique_ptr<IOReactor> reactor_;
+
+  // Frame scheduling, render thread. A frame is rendered only for a new snapshot, a blink deadline, a selection
+  //  change or a window event, at most once per refresh interval, and never while the window is hidden.
+  // SDL event pushed when there is something new to render, at most one is queued
+  uint32_t redraw_event_type_ = 0;
+  std::atomic<bool> redraw_event_pending_ = false;
+  bool window_visible_ = true;
+  std::chrono::high_resolution_clock::time_point last_present_time_;
+  std::chrono::nanoseconds frame_interval_ = std::chrono::nanoseconds(1000000000 / 60);
 
   // rendering
   SDL_Window *window_ = nullptr;
   SDL_Renderer *renderer_ = nullptr;
   TTF_Font *font_ = nullptr;
+  std::vector<TTF_Font*> fallback_fonts_;
   std::unique_ptr<FontCache> font_cache_;
 
-  // child process
-  TTYInput tty_input_;
-  std::unique_ptr<Subprocess> subprocess_;
+  // row version -> rendered row, shared by the panes since row versions are unique across sessions
+  struct RowTexture {
+    SDL_Texture *texture = nullptr;
+    // false if some glyphs were missing
+    bool complete = false;
+    // width of the texture in cells
+    int cols = 0;
+  };
+  std::unordered_map<uint64_t, RowTexture> row_textures_, next_row_textures_;
+  std::vector<RowTexture> free_row_textures_;
+
+  // (color, x, w) background runs of the row being rendered
+  std::vector<std::tuple<Color, int, int>> row_bg_rects_;
+  // [start, end) cell runs of the row being rendered that are drawn shaped
+  std::vector<std::tuple<int, int>> row_shaped_runs_;
+
+  // without acceleration the frame is composited on the CPU instead of in row and frame textures
+  std::unique_ptr<SoftwareCompositor> software_compositor_;
+  // streaming texture the dirty rows of the window sized framebuffer are uploaded to
+  SDL_Texture *software_texture_ = nullptr;
 
-  // window title
-  std::string window_title_ = "alex's te";
-  std::vector<std::string> xterm_title_stack_;
+  // title of the focused session shown in the window title
+  std::string shown_window_title_ = "alex's te";
 
-  // background image
-  SDL_Texture *background_image_texture = nullptr;
-  int background_image_width = 0, background_image_height = 0;
+  // background image, decoded on a worker thread to keep it off the startup path
+  std::future<SDL_Surface*> background_image_future_;
+  SDL_Surface *background_image_surface = nullptr;
+  // the image tiled and padded over the window and blended over the clear color, rebuilt on resize.
+  // background_texture_ holds the same pixels for the texture path.
+  std::vector<Color> background_layer_;
+  int background_layer_w_ = 0, background_layer_h_ = 0;
+  SDL_Texture *background_texture_ = nullptr;
   // 0 - 255
   int background_image_opaque = 128;
 
-  // display sizes
+  // the window is cleared with this color every frame, cell backgrounds of this color are not drawn
+  Color clear_color_ = ColorBlack;
+
+  // the palette of the pane being rendered resolved with reverse video applied, indexed by color_variant(),
+  //  rebuilt by update_color_lut() on the render thread when it differs from the previous pane
+  enum {
+    COLOR_VARIANT_BOLD = 1,
+    COLOR_VARIANT_FAINT = 2,
+    COLOR_VARIANT_COUNT = 4
+  };
+  std::array<std::array<Color, PALETTE_SIZE>, COLOR_VARIANT_COUNT> color_lut_{};
+  uint64_t lut_palette_version_ = UINT64_MAX;
+  bool lut_reverse_video_ = false;
+
+  // cursor blinking, render thread
+  int cursor_flip_ = 0;
+  std::chrono::high_resolution_clock::time_point cursor_last_time_;
+  std::chrono::milliseconds blink_interval_ = std::chrono::milliseconds(300);
+
+  // display sizes, panes have their own rows and cols
   int glyph_height_, glyph_width_;
   int resolution_w_, resolution_h_;
-  int max_rows_, max_cols_;
+  // the panes are separated by this many pixels
+  int separator_width_ = 2;
+  Color separator_color_ = Color{0xff404040};
+  Color tab_bg_color_ = Color{0xff202020}, tab_fg_color_ = ColorWhite;
+  Color active_tab_bg_color_ = Color{0xff404040}, active_tab_fg_color_ = ColorBrightWhite;
 
-  // clipboard
+  // clipboard, the selection is in the focused pane
   bool has_selection = false;
   bool mouse_left_button_down = false;
   int selection_start_row = 0, selection_start_col = 0;
   int selection_end_row = 0, selection_end_col = 0;
   Color selection_bg_color = Color{0xff666666}, selection_fg_color = Color{0xff111111};
 
+  // per-stage latencies of all sessions, dumped on SIGUSR1 and through stats_socket_path
+  LatencyStats stats_;
+  std::unique_ptr<LatencyStatsServer> stats_server_;
+  std::unique_ptr<LatencyBench> latency_bench_;
+
+  // performance HUD in the top right corner of the focused pane, toggled with ctrl+shift+h
+  bool hud_visible_ = false;
+  std::chrono::milliseconds hud_interval_ = std::chrono::milliseconds(500);
+  std::vector<std::string> hud_lines_;
+  std::chrono::high_resolution_clock::time_point hud_last_update_;
+  uint64_t hud_last_bytes_ = 0, hud_last_hits_ = 0, hud_last_misses_ = 0;
+  Color hud_bg_color_ = Color{0xff202020}, hud_fg_color_ = ColorBrightWhite;
+  // SDL draw calls of the render thread, glyph batches are counted by the font cache
+  uint64_t draw_calls_ = 0;
+  uint64_t last_frame_draw_calls_ = 0;
+  // render and present of the last frame
+  std::chrono::nanoseconds last_frame_time_{0};
+
   // misc
   std::ostream &log_stream_;
 };
@@ -1,36 +1,191 @@
 #pragma once
 
+#include <bitset>
+#include <list>
+#include <memory>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <cinttypes>
 #include <string>
 #include <vector>
 
+#include <te/basic.hpp>
+#include <te/glyph_disk_cache.hpp>
+#include <te/glyph_rasterizer.hpp>
+
 struct SDL_Window;
 struct SDL_Texture;
 struct SDL_Renderer;
+struct SDL_Surface;
+struct SDL_Vertex;
 struct _TTF_Font;
 typedef _TTF_Font TTF_Font;
 
 namespace te {
 
+// Glyphs are rasterized on first use into fixed size slots of a few atlas textures,
+//  and drawn in one SDL_RenderGeometry batch per atlas page.
+// Rasterization runs on a GlyphRasterizer worker pool, a new glyph is missing until its bitmap is uploaded
+//  in a following frame. Bitmaps are persisted in a GlyphDiskCache, glyphs any te process has seen before
+//  are not rasterized again.
+// When the memory budget is used up, the least recently used glyph gives its slot away.
+// Shaped runs (ligatures, combining marks, complex scripts) are rendered as one string by SDL_ttf, which shapes
+//  with HarfBuzz, and cut into one slice per cell. The slices are cached like glyphs, keyed by the run text,
+//  so a run is shaped once and drawn in the same batches as single glyphs.
+// Without a renderer no atlas is created, the alpha bitmaps are kept for a SoftwareCompositor instead.
 class FontCache {
  public:
-  FontCache(SDL_Renderer *renderer, TTF_Font *font);
-  SDL_Texture *at(std::tuple<uint32_t, std::string> pos) const {
-    auto &item = fc.at(std::get<0>(pos));
-    auto it = item.find(std::get<1>(pos));
-    if (it == item.end()) {
-      return nullptr;
-    } else {
-      return it->second;
+  // location of a glyph in the atlas
+  struct Glyph {
+    int page;
+    int x, y, w, h;
+  };
+
+  enum class RunStatus {
+    READY,
+    // being shaped, draw the cells one by one for now
+    PENDING,
+    // no single font covers the run, draw the cells one by one
+    UNAVAILABLE,
+  };
+  // runs longer than this are not shaped
+  static constexpr int max_run_cells = 64;
+
+  // fonts: the primary font followed by the fallback chain, all of the same size, loaded from font_paths
+  FontCache(SDL_Renderer *renderer,
+            std::vector<TTF_Font*> fonts,
+            const std::vector<std::string> &font_paths,
+            int font_size,
+            int glyph_width,
+            int glyph_height,
+            size_t memory_budget_bytes,
+            int n_rasterizer_workers);
+  ~FontCache();
+
+  // c: one utf8 grapheme. Glyphs no font provides are drawn as '?'.
+  // Returns nullptr while the glyph is being rasterized, the caller should skip it for this frame.
+  const Glyph *get(uint32_t style, const std::string &c);
+  // same as get, for a cache without renderer
+  const GlyphRasterizer::Bitmap *get_bitmap(uint32_t style, const std::string &c);
+  // text: the utf8 of cells consecutive cells. If READY, glyphs[i] is the slice of the shaped run for cell i.
+  RunStatus get_run(uint32_t style, const std::string &text, int cells, std::vector<const Glyph*> &glyphs);
+  // same as get_run, for a cache without renderer
+  RunStatus get_run_bitmaps(uint32_t style,
+                            const std::string &text,
+                            int cells,
+                            std::vector<const GlyphRasterizer::Bitmap*> &bitmaps);
+
+  // Upload the glyphs rasterized since the last frame, at most max_uploads_per_frame_ of them, with one texture
+  //  update per atlas page.
+  // Glyphs used since the last call can not be evicted before the batch is flushed.
+  // Returns true if new glyphs became available.
+  bool next_frame();
+
+  // the renderer lost its textures, the atlas pages are recreated and uploaded again with the next frame
+  void reset_textures();
+
+  // glyphs requested but not uploaded yet
+  bool has_pending() const {
+    return !pending_.empty();
+  }
+
+  // queue a glyph to be drawn into the box (x, y, w, h) with color
+  void draw(const Glyph &glyph, int x, int y, int w, int h, Color color);
+  // submit all queued glyphs, one draw call per atlas page
+  void flush();
+
+  size_t size() const {
+    return fc.size();
+  }
+  // counters since creation
+  uint64_t hits() const {
+    return hits_;
+  }
+  uint64_t misses() const {
+    return misses_;
+  }
+  uint64_t draw_calls() const {
+    return draw_calls_;
+  }
+  size_t memory_bytes() const {
+    if (!renderer_) {
+      return (size_t) next_slot_ * slot_width_ * slot_height_;
     }
+    // the textures and their alpha copies
+    return pages_.size() * page_width_ * page_height_ * 5;
   }
+
  private:
-  // style -> utf8 char -> texture
-  std::unordered_map<uint32_t, std::unordered_map<std::string, SDL_Texture*>> fc;
+  struct Entry {
+    Glyph glyph;
+    std::list<std::string>::iterator lru;
+    uint64_t last_used_frame;
+    // only kept without renderer
+    GlyphRasterizer::Bitmap bitmap;
+  };
+
+  Entry *find(uint32_t style, const std::string &c);
+  RunStatus find_run(uint32_t style, const std::string &text, int cells);
+  Entry *touch(Entry &entry);
+  // add a rasterized bitmap under key, which may be bitmap.key. false if it could not be placed in the atlas,
+  //  bitmap is left as it was then.
+  bool insert(const std::string &key, GlyphRasterizer::Bitmap &&bitmap);
+  bool allocate_slot(Glyph &glyph);
+  SDL_Texture *create_page();
+  // copy bitmap into the slot of glyph in its page's alpha, uploaded by upload_pages()
+  void stage(const Glyph &glyph, const GlyphRasterizer::Bitmap &bitmap);
+  // one texture update per page for the rectangle staged since the last call, false if one failed
+  bool upload_pages();
+  int font_for(uint32_t codepoint);
+
+  // (char(style) + utf8 char) -> glyph
+  // (char(style | run_key_flag) + char(cells) + run text + '\0' + char(cell)) -> slice of a shaped run,
+  //  the rasterizer and the disk cache see the whole run under the key without the cell suffix
+  std::unordered_map<std::string, Entry> fc;
+  static constexpr uint32_t run_key_flag = 0x80;
+  // entries of the last find_run()
+  std::vector<Entry*> run_entries_;
+  // keys no font can render
+  std::unordered_set<std::string> missing_;
+  // keys submitted to the rasterizer
+  std::unordered_set<std::string> pending_;
+  std::unique_ptr<GlyphDiskCache> disk_cache_;
+  std::unique_ptr<GlyphRasterizer> rasterizer_;
+  // finished bitmaps waiting to be uploaded
+  std::vector<GlyphRasterizer::Bitmap> ready_;
+  // bounds the frame time when many new glyphs appear at once
+  size_t max_uploads_per_frame_ = 256;
+  // per page, the coverage of its slots and the rectangle staged since the last upload, empty if x0 == x1
+  struct DirtyRect {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+  };
+  std::vector<std::vector<uint8_t>> page_alpha_;
+  std::vector<DirtyRect> page_dirty_;
+  // reused for uploads
+  std::vector<uint32_t> upload_pixels_;
+  // front: most recently used
+  std::list<std::string> lru_;
+  uint64_t frame_ = 0;
+  uint64_t hits_ = 0, misses_ = 0, draw_calls_ = 0;
+
   SDL_Renderer *renderer_;
-  TTF_Font *font_;
+  std::vector<TTF_Font*> fonts_;
+  // per font, 256 codepoint block -> which codepoints the font provides, filled on first use of a block
+  std::vector<std::unordered_map<uint32_t, std::bitset<256>>> coverage_;
+
+  // atlas, every glyph takes one slot of slot_width_ x slot_height_ pixels
+  std::vector<SDL_Texture*> pages_;
+  int glyph_width_;
+  int page_width_ = 1024, page_height_ = 1024;
+  int slot_width_, slot_height_;
+  int slots_per_row_, slots_per_page_;
+  int max_pages_;
+  int next_slot_ = 0;
+
+  // per page vertex batches, reused between frames
+  std::vector<std::vector<SDL_Vertex>> vertices_;
+  std::vector<std::vector<int>> indices_;
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cinttypes>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <te/glyph_rasterizer.hpp>
+
+namespace te {
+
+// Rasterized glyph bitmaps persisted in an append-only file shared by all te processes.
+// There is one file per font chain, font size and DPI. The file is mapped read-only, so the pages are shared
+//  between processes, and new glyphs are appended under an exclusive flock().
+// All methods are thread safe.
+class GlyphDiskCache {
+ public:
+  // the cache is disabled if the file can not be opened
+  explicit GlyphDiskCache(const std::string &path);
+  ~GlyphDiskCache();
+
+  // $XDG_CACHE_HOME/te/glyphs-<hash>.bin, the hash covers the paths, inodes, sizes and mtimes of the font files,
+  //  the font size and DPI
+  static std::string default_path(const std::vector<std::string> &font_paths, int font_size, int dpi);
+
+  bool ok() const {
+    return fd_ >= 0;
+  }
+
+  // fill bitmap with the glyph stored under key, called by the rasterizer workers since it may wait for the
+  //  flock() of another process
+  bool lookup(const std::string &key, GlyphRasterizer::Bitmap &bitmap);
+  // append a bitmap if no process stored it yet
+  void store(const GlyphRasterizer::Bitmap &bitmap);
+
+ private:
+  // map and index the records appended since the last call, caller holds mutex_
+  void refresh();
+
+  std::mutex mutex_;
+  int fd_ = -1;
+  const uint8_t *map_ = nullptr;
+  size_t map_size_ = 0;
+  // end of the last valid record
+  size_t scanned_ = 0;
+  // key -> record offset
+  std::unordered_map<std::string, size_t> index_;
+};
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <cinttypes>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct _TTF_Font;
+typedef _TTF_Font TTF_Font;
+
+namespace te {
+
+class GlyphDiskCache;
+
+// A pool of worker threads rasterizing glyphs into CPU alpha bitmaps.
+// Every worker has its own TTF_Font instances, SDL_ttf fonts can not be shared between threads.
+class GlyphRasterizer {
+ public:
+  struct Job {
+    // opaque to the rasterizer, returned with the bitmap
+    std::string key;
+    uint32_t style;
+    // utf8 grapheme
+    std::string c;
+    // index into font_paths
+    int font;
+    // crop width, 0 for max_width. Shaped runs span several cells.
+    int max_width = 0;
+  };
+
+  struct Bitmap {
+    std::string key;
+    // false if the font failed to render the glyph, error tells why
+    bool ok = false;
+    std::string error;
+    int w = 0, h = 0;
+    // w * h coverage values
+    std::vector<uint8_t> alpha;
+  };
+
+  // bitmaps are cropped to max_width x max_height
+  // disk_cache: if not nullptr, jobs are looked up in it first, and every rasterized bitmap is stored in it
+  GlyphRasterizer(const std::vector<std::string> &font_paths,
+                  int font_size,
+                  int max_width,
+                  int max_height,
+                  int n_workers,
+                  GlyphDiskCache *disk_cache);
+  ~GlyphRasterizer();
+
+  void submit(Job job);
+  // move the bitmaps finished since the last call to the end of results, never blocks on a rasterization
+  void collect(std::vector<Bitmap> &results);
+
+ private:
+  void worker_loop(int index);
+
+  int max_width_, max_height_;
+  GlyphDiskCache *disk_cache_;
+  // worker -> font chain
+  std::vector<std::vector<TTF_Font*>> fonts_;
+  std::vector<std::thread> workers_;
+
+  std::mutex jobs_mutex_;
+  std::condition_variable jobs_cv_;
+  std::deque<Job> jobs_;
+  bool stop_ = false;
+
+  std::mutex results_mutex_;
+  std::vector<Bitmap> results_;
+};
+
+}
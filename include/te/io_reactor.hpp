@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cinttypes>
+#include <memory>
+#include <vector>
+
+namespace te {
+
+class Session;
+
+// Multiplexes the ptys and child processes of all sessions on a few worker threads.
+// Every session is bound to one worker, which reads its pty in batches into two buffers of the session, so the
+//  kernel fills one while the other is parsed, and writes the output queued in the meantime in one go.
+// A worker serves its ready sessions round robin with a read budget per turn, so a flooding session does not
+//  starve the others, and idle sessions cost nothing but their fds.
+// Keystrokes are written between the reads of a batch. Flooding sessions publish their screens once per frame,
+//  the worker publishes what they left unpublished when the frame is over.
+// Workers use io_uring when the kernel allows it, and epoll otherwise.
+class IOReactor {
+ public:
+  // bytes of one read
+  static constexpr size_t read_size = 16 * 1024;
+  // bytes a session may parse in one turn before the other ready sessions of its worker get theirs, with io_uring
+  //  a turn is the one read of the session in each batch of completions
+  static constexpr size_t read_budget = 32 * 1024;
+
+  explicit IOReactor(int n_workers, bool use_io_uring = true);
+  ~IOReactor();
+
+  // Serve session from now on, returns the worker it is bound to.
+  // pid_fd: pidfd of the child, -1 if the kernel has none. Both fds stay open until remove().
+  int add(Session *session, int tty_fd, int pid_fd);
+  // no callbacks into session run once this returns, never called on a worker thread
+  void remove(int worker, Session *session);
+  // run Session::service() of session on its worker and write its queued output, any thread
+  void wakeup(int worker, Session *session);
+
+  // "io_uring" or "epoll"
+  const char *backend() const;
+
+  class Worker;
+
+ private:
+  std::vector<std::unique_ptr<Worker>> workers_;
+};
+
+}
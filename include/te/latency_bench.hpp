@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <cinttypes>
+#include <iostream>
+#include <vector>
+
+struct SDL_Renderer;
+
+namespace te {
+
+// Key-to-screen latency measurement, `te --latency-bench`.
+// A synthetic SDL_KEYDOWN is pushed into the SDL event queue, so it takes the path of a real key press, and the
+//  rendered frame is read back until the cell under the cursor changes. The sample ends when that frame is
+//  presented. The child decides what is echoed, e.g. cat, a shell or a deliberately slow program.
+class LatencyBench {
+ public:
+  using clock = std::chrono::high_resolution_clock;
+
+  // n_samples: measured key presses
+  // gap: quiet time after an echo before the next key, so frames of the last echo do not overlap
+  LatencyBench(int n_samples, std::chrono::milliseconds gap);
+
+  bool done() const {
+    return samples_.size() + timeouts_ >= (size_t) n_samples_;
+  }
+  // when the bench needs the next frame, to send a key or to give up on an echo. time_point::max() if none
+  clock::time_point next_wakeup() const;
+
+  // after a frame was rendered, before it is presented. The cell (x, y, w, h) is where the next key is echoed.
+  void on_render(SDL_Renderer *renderer, int x, int y, int w, int h);
+  void on_present(clock::time_point now);
+
+  // the latency distribution
+  void report(std::ostream &out) const;
+
+ private:
+  enum class State {
+    // waiting for gap to pass
+    Idle,
+    // key pushed, the cell still shows the baseline
+    Waiting,
+    // the echo is rendered, waiting for present
+    Echoed,
+  };
+
+  void push_key(int32_t sym);
+  bool read_cell(SDL_Renderer *renderer, std::vector<uint32_t> &pixels) const;
+
+  int n_samples_;
+  std::chrono::milliseconds gap_;
+  // an echo that does not arrive within this time is counted as lost
+  std::chrono::milliseconds timeout_ = std::chrono::milliseconds(2000);
+
+  State state_ = State::Idle;
+  clock::time_point next_key_time_;
+  clock::time_point key_time_;
+  int cell_x_ = 0, cell_y_ = 0, cell_w_ = 0, cell_h_ = 0;
+  std::vector<uint32_t> baseline_, pixels_;
+  // keys typed on the current line, a new line is started before the line wraps
+  int line_length_ = 0;
+  int max_line_length_ = 32;
+  int next_char_ = 0;
+
+  std::vector<double> samples_;
+  size_t timeouts_ = 0;
+};
+
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace te {
+
+// Log-linear histogram of nanosecond values, every power of two is split into 32 buckets (about 3% precision).
+// record() is wait-free and may run concurrently with the readers.
+class LatencyHistogram {
+ public:
+  void record(uint64_t ns);
+
+  uint64_t count() const {
+    return count_.load(std::memory_order_relaxed);
+  }
+  uint64_t max() const {
+    return max_.load(std::memory_order_relaxed);
+  }
+  double mean() const;
+  // q in [0, 1]
+  uint64_t percentile(double q) const;
+
+ private:
+  static constexpr int sub_bucket_bits = 5;
+  static constexpr int sub_buckets = 1 << sub_bucket_bits;
+  static constexpr int n_buckets = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+  static int bucket_of(uint64_t ns);
+  // middle of the values in a bucket
+  static uint64_t value_of(int bucket);
+
+  std::array<std::atomic<uint64_t>, n_buckets> buckets_{};
+  std::atomic<uint64_t> count_ = 0, sum_ = 0, max_ = 0;
+};
+
+// Always-on counters of the pipeline from key press to present, shared by the parser and render threads.
+class LatencyStats {
+ public:
+  enum Stage {
+    // SDL events to input written to the tty
+    STAGE_INPUT = 0,
+    // one read() of the tty
+    STAGE_PTY_READ,
+    // parsing a read buffer and applying it to the screen
+    STAGE_PARSE,
+    // publishing the screen as a snapshot
+    STAGE_APPLY,
+    STAGE_RENDER,
+    STAGE_PRESENT,
+
+    STAGE_COUNT
+  };
+
+  LatencyStats();
+
+  void record(Stage stage, std::chrono::nanoseconds duration) {
+    histograms_[stage].record(std::max<int64_t>(0, duration.count()));
+  }
+  void add_bytes(uint64_t n) {
+    bytes_.fetch_add(n, std::memory_order_relaxed);
+  }
+  void add_frame() {
+    frames_.fetch_add(1, std::memory_order_relaxed);
+  }
+  uint64_t bytes() const {
+    return bytes_.load(std::memory_order_relaxed);
+  }
+
+  // percentiles in microseconds, totals, and rates since the previous call
+  std::string to_json();
+
+ private:
+  std::array<LatencyHistogram, STAGE_COUNT> histograms_;
+  std::atomic<uint64_t> bytes_ = 0, frames_ = 0;
+  std::chrono::steady_clock::time_point start_time_;
+
+  // state of the previous to_json()
+  std::mutex mutex_;
+  std::chrono::steady_clock::time_point last_time_;
+  uint64_t last_bytes_ = 0, last_frames_ = 0;
+};
+
+// Dumps LatencyStats as JSON to stderr on SIGUSR1, and to every client connecting to a unix socket,
+//  e.g. `socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/te-<pid>.stats`.
+class LatencyStatsServer {
+ public:
+  // socket_path: no socket if empty
+  LatencyStatsServer(LatencyStats &stats, std::string socket_path);
+  ~LatencyStatsServer();
+
+  // $XDG_RUNTIME_DIR/te-<pid>.stats, or in /tmp
+  static std::string default_socket_path();
+
+ private:
+  void loop();
+  void write_json(int fd);
+
+  LatencyStats &stats_;
+  std::string socket_path_;
+  int listen_fd_ = -1;
+  // written by the signal handler
+  int signal_pipe_[2] = {-1, -1};
+  int stop_fd_ = -1;
+  std::thread thread_;
+};
+
+}
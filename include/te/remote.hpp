@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cinttypes>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <te/basic.hpp>
+#include <te/latency_stats.hpp>
+
+namespace te {
+
+class IOReactor;
+class Row;
+class Session;
+struct ScreenSnapshot;
+
+// Detachable sessions: `te --server path` holds a session without a window, GUI clients attach to it with
+//  `te --attach path`. The session outlives its clients, and several clients can watch and type into it.
+// The server sends screen diffs instead of the child's output. A client is sent the rows it does not have yet,
+//  the rows it has are referenced by their position in its last frame, so scrolling moves rows instead of
+//  resending them, and attaching costs one screen however long the history is.
+
+// Every message is [u32 body size][u8 type][body], in native byte order since the socket is local.
+enum RemoteMessage : uint8_t {
+  // client -> server: bytes for the tty
+  REMOTE_INPUT = 1,
+  // client -> server: i32 rows, i32 cols
+  REMOTE_RESIZE,
+  // server -> client: a RemoteFrameEncoder diff
+  REMOTE_FRAME,
+  // client -> server: a chunk of a paste, keystrokes of other clients go first
+  REMOTE_PASTE,
+};
+
+void append_remote_message(std::string &out, RemoteMessage type, std::string_view body);
+
+// splits the bytes read from the socket into messages
+class RemoteMessageReader {
+ public:
+  // the largest message accepted, a larger size means the stream is corrupt
+  static constexpr uint32_t max_message_size = 64 * 1024 * 1024;
+
+  void feed(const char *data, size_t n);
+  // the next complete message, valid until the next feed(). false if there is none or the stream is corrupt.
+  bool next(RemoteMessage &type, std::string_view &body);
+  bool corrupt() const {
+    return corrupt_;
+  }
+
+ private:
+  std::string buffer_;
+  size_t offset_ = 0;
+  bool corrupt_ = false;
+};
+
+// Server, one per client: the snapshot as a diff against the last frame sent to the client.
+class RemoteFrameEncoder {
+ public:
+  void encode(const ScreenSnapshot &snapshot, std::string &out);
+  // version of the snapshot of the last frame, 0 before the first one
+  uint64_t sent_version() const {
+    return sent_version_;
+  }
+
+ private:
+  // server row versions of the rows of the last frame
+  std::vector<uint64_t> row_versions_;
+  std::unordered_map<uint64_t, int> row_index_;
+  uint64_t palette_version_ = UINT64_MAX;
+  uint64_t sent_version_ = 0;
+};
+
+// Client: applies frames to the rows of the previous one. Rows get versions of the client, so the row caches of
+//  the renderer work as for a local session.
+class RemoteFrameDecoder {
+ public:
+  // nullptr if the frame is corrupt
+  std::shared_ptr<ScreenSnapshot> decode(std::string_view frame);
+
+ private:
+  std::vector<std::shared_ptr<const Row>> rows_;
+  std::shared_ptr<const Palette> palette_ = std::make_shared<const Palette>(Palette::default_palette());
+};
+
+// The server side: one session without a window, served to the clients connected to socket_path.
+class RemoteServer {
+ public:
+  RemoteServer(std::ostream &log_stream,
+               const std::vector<std::string> &args,
+               const std::string &term_env,
+               const std::vector<std::string> &environment_variables,
+               std::string socket_path,
+               bool verbose_log = false);
+  ~RemoteServer();
+
+  // serve clients until the session exits
+  void loop();
+  // any thread: a snapshot was published, or the session exited
+  void wakeup() const;
+
+ private:
+  struct Client {
+    int fd = -1;
+    RemoteMessageReader reader;
+    RemoteFrameEncoder encoder;
+    // frames waiting for the socket, a client that falls behind skips to the latest snapshot
+    std::string output;
+    size_t output_offset = 0;
+  };
+
+  // false if the client is gone
+  bool read_client(Client &client);
+  bool flush_client(Client &client);
+
+  std::string socket_path_;
+  int listen_fd_ = -1;
+  int wakeup_fd_ = -1;
+  std::vector<std::unique_ptr<Client>> clients_;
+
+  LatencyStats stats_;
+  std::unique_ptr<IOReactor> reactor_;
+  std::unique_ptr<Session> session_;
+};
+
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <bitset>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -10,31 +13,148 @@
 #include <vector>
 
 #include <te/basic.hpp>
+#include <te/unicode.hpp>
 
 namespace te {
 
-class Display;
+class Session;
+
+// One line of a screen.
+// Erasing is lazy: the cells from blank_from() to the end of the row are all blank_char(),
+//  the underlying cells are only overwritten when they are written to again.
+class Row {
+ public:
+  explicit Row(int cols) :cells_(cols), blank_from_(0), version_(next_version()) {}
+
+  int size() const {
+    return cells_.size();
+  }
+  const Char &operator[](int col) const {
+    return col >= blank_from_ ? blank_ : cells_[col];
+  }
+  // writable cell, materializes the lazily erased cells up to col
+  Char &at(int col) {
+    if (col >= blank_from_) {
+      for (int i = blank_from_; i <= col; i++) {
+        cells_[i] = blank_;
+      }
+      blank_from_ = col + 1;
+    }
+    return cells_[col];
+  }
+  // erase from col to the end of the row, O(1) in the common case
+  void erase(int from_col, const Char &blank) {
+    if (from_col > blank_from_) {
+      // keep the previously erased cells before from_col
+      at(from_col - 1);
+    }
+    blank_from_ = from_col;
+    blank_ = blank;
+  }
+  void reset() {
+    erase(0, Char());
+  }
+
+  // cells in [blank_from(), size()) are blank_char()
+  int blank_from() const {
+    return blank_from_;
+  }
+  const Char &blank_char() const {
+    return blank_;
+  }
+
+  // unique across all rows and all changes, renderers cache rows by version
+  uint64_t version() const {
+    return version_;
+  }
+  void touch() {
+    version_ = next_version();
+  }
+
+ private:
+  static uint64_t next_version() {
+    static std::atomic<uint64_t> version = 0;
+    return version.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  std::vector<Char> cells_;
+  int blank_from_;
+  Char blank_;
+  uint64_t version_;
+};
+
+// Immutable view of a screen published by the parser thread for the render thread.
+// Rows are shared with the screen, the screen copies a row before writing to it if a snapshot still holds it.
+struct ScreenSnapshot {
+  std::vector<std::shared_ptr<const Row>> rows;
+  int max_rows = 0, max_cols = 0;
+
+  int cursor_row = 0, cursor_col = 0;
+  bool cursor_show = true, cursor_blink = true;
+  Color cursor_color = ColorWhite, cursor_fg_color = ColorBrightBlack;
+
+  std::bitset<CHAR_ATTR_COUNT> attrs;
+  std::string window_title;
+  // rows scrolled up since the screen was created, renderers shift the previous frame by the difference
+  int64_t scroll_offset = 0;
+  bool alternate_screen = false;
+  std::shared_ptr<const Palette> palette;
+  // increased every time a snapshot is published
+  uint64_t version = 0;
+  // rows held by the screen including scrollback, and an estimate of their memory
+  size_t buffer_rows = 0;
+  size_t buffer_bytes = 0;
+};
+
 class Screen {
  public:
-  explicit Screen(Display *display);
+  // scrollback: false for the alternate screen, which is a fixed grid of max_rows_ rows
+  //  that is allocated once in resize() and then only cleared in place
+  Screen(Session *session, bool scrollback);
 
   bool process_csi(const std::string &seq);
+  // select graphic rendition, seq without the final 'm'
+  bool process_sgr(const std::string &seq);
 
   void reset_tty_buffer() {
+    if (!scrollback_ && rows_.size() == max_rows_ && (rows_.empty() || rows_[0]->size() == max_cols_)) {
+      clear_tty_buffer();
+      return;
+    }
     rows_.clear();
     for (int i = 0; i < max_rows_; i++) {
-      rows_.emplace_back(max_cols_);
+      rows_.push_back(std::make_shared<Row>(max_cols_));
+    }
+    current_screen_start_row = 0;
+    cursor_row = 0;
+    cursor_col = 0;
+  }
+
+  // Reset every row without touching the row storage, O(rows)
+  void clear_tty_buffer() {
+    for (size_t i = 0; i < rows_.size(); i++) {
+      row_at(i).reset();
     }
     current_screen_start_row = 0;
     cursor_row = 0;
     cursor_col = 0;
   }
 
-  Color get_default_fg_color() const {
-    return ColorWhite;
+  // DECSC/DECRC, also used by CSI ?1049h/l
+  void save_cursor() {
+    saved_cursor_row = cursor_row;
+    saved_cursor_col = cursor_col;
   }
-  Color get_default_bg_color() const {
-    return ColorBlack;
+  void restore_cursor() {
+    cursor_row = std::min(saved_cursor_row, max_rows_ - 1);
+    cursor_col = std::min(saved_cursor_col, max_cols_ - 1);
+  }
+
+  CellColor get_default_fg_color() const {
+    return CellColor::indexed(PALETTE_DEFAULT_FG);
+  }
+  CellColor get_default_bg_color() const {
+    return CellColor::indexed(PALETTE_DEFAULT_BG);
   }
 
   void resize(int rows, int cols) {
@@ -50,59 +170,199 @@ class Screen {
 // private:
   void new_line() {
     if (cursor_row == max_rows_ - 1) {
-      rows_.emplace_back(max_cols_);
-      current_screen_start_row++;
+      scroll_up(1);
     } else {
       cursor_row++;
     }
   }
+  // move the content up by n rows, new blank rows appear at the bottom
+  void scroll_up(int n) {
+    scroll_offset += n;
+    last_grapheme_col = -1;
+    if (scrollback_) {
+      for (int i = 0; i < n; i++) {
+        rows_.push_back(std::make_shared<Row>(max_cols_));
+      }
+      current_screen_start_row += n;
+    } else {
+      // the alternate screen is a ring of max_rows_ rows, the top row is recycled as the new bottom row
+      n = std::min(n, max_rows_);
+      for (int i = 0; i < n; i++) {
+        row_at(current_screen_start_row).reset();
+        current_screen_start_row = (current_screen_start_row + 1) % max_rows_;
+      }
+    }
+  }
+  // move the content down by n rows, new blank rows appear at the top. Only for the alternate screen.
+  void scroll_down(int n) {
+    scroll_offset -= n;
+    last_grapheme_col = -1;
+    n = std::min(n, max_rows_);
+    for (int i = 0; i < n; i++) {
+      current_screen_start_row = (current_screen_start_row + max_rows_ - 1) % max_rows_;
+      row_at(current_screen_start_row).reset();
+    }
+  }
   void carriage_return() {
     cursor_col = 0;
   }
-  // c: one char, maybe utf8
-  void fill_current_cursor(std::string c) {
-    get_row(cursor_row)[cursor_col].c = std::move(c);
-    get_row(cursor_row)[cursor_col].bg_color = current_bg_color;
-    get_row(cursor_row)[cursor_col].fg_color = current_fg_color;
+  // c: one grapheme, maybe utf8. width: 2 for a double width grapheme, which also takes the next cell.
+  void fill_current_cursor(std::string c, int width = 1) {
+    auto &row = get_row(cursor_row);
+    split_wide_char(row, cursor_col);
+    auto &cell = row.at(cursor_col);
+    cell.c = std::move(c);
+    cell.bg_color = current_bg_color;
+    cell.fg_color = current_fg_color;
+    cell.attr = current_attrs & std::bitset<CHAR_ATTR_COUNT>(CharAttrSGRMask);
+    if (width == 2 && cursor_col + 1 < row.size()) {
+      cell.attr.set(CHAR_ATTR_WIDE);
+      split_wide_char(row, cursor_col + 1);
+      auto &spacer = row.at(cursor_col + 1);
+      spacer = cell;
+      spacer.c.clear();
+      spacer.attr.reset(CHAR_ATTR_WIDE);
+      spacer.attr.set(CHAR_ATTR_WIDE_SPACER);
+    }
+    last_grapheme_row = cursor_row;
+    last_grapheme_col = cursor_col;
+    last_grapheme_end_col = cursor_col + width;
+  }
+
+  // Append a combining character to the grapheme written last, if the cursor is still right after it.
+  // Returns false if there is no such grapheme.
+  bool append_to_last_grapheme(const std::string &c) {
+    if (last_grapheme_col < 0 || cursor_row != last_grapheme_row || cursor_col != last_grapheme_end_col) {
+      return false;
+    }
+    const auto &current = get_row_data(last_grapheme_row)[last_grapheme_col];
+    if (current.c.empty()) {
+      // erased in the meantime
+      return false;
+    }
+    // the marks of overlong graphemes are dropped, they do not render anyway
+    if (current.c.size() < max_grapheme_bytes) {
+      get_row(last_grapheme_row).at(last_grapheme_col).c += c;
+    }
+    return true;
+  }
+
+  // writing over one half of a double width character erases the other half
+  void split_wide_char(Row &row, int col) {
+    const auto &cell = row[col];
+    if (cell.attr.test(CHAR_ATTR_WIDE) && col + 1 < row.size()) {
+      row.at(col + 1).attr.reset(CHAR_ATTR_WIDE_SPACER);
+    } else if (cell.attr.test(CHAR_ATTR_WIDE_SPACER) && col > 0) {
+      auto &wide = row.at(col - 1);
+      wide.c.clear();
+      wide.attr.reset(CHAR_ATTR_WIDE);
+    }
   }
 
-  // both including
+  // Erase from (from_row, from_col) to (to_row, to_col) in reading order, both including.
+  // Erasing to the end of a row only updates the row's blank marker.
   void clear_screen(int from_row, int from_col, int to_row, int to_col) {
+    // erased cells keep the current background color (bce)
+    Char blank;
+    blank.bg_color = current_bg_color;
     for (int i = from_row; i <= to_row ; i++) {
-      for (int j = from_col; j <= to_col; j++) {
-        get_row(i)[j].reset();
+      int start = i == from_row ? from_col : 0;
+      int end = i == to_row ? to_col : max_cols_ - 1;
+      auto &row = get_row(i);
+      if (end >= max_cols_ - 1) {
+        row.erase(start, blank);
+      } else {
+        for (int j = start; j <= end; j++) {
+          row.at(j) = blank;
+        }
       }
     }
   }
 
-  std::vector<Char> &get_row(int row) {
-    return rows_[current_screen_start_row + row];
+  // writable row on screen
+  Row &get_row(int row) {
+    return row_at(row_index(row));
+  }
+  // read only, the row keeps its version
+  const Row &get_row_data(int row) const {
+    return *rows_[row_index(row)];
+  }
+
+  size_t row_index(int row) const {
+    if (scrollback_) {
+      return current_screen_start_row + row;
+    } else {
+      return (current_screen_start_row + row) % max_rows_;
+    }
+  }
+
+  // copy on write: snapshots may still hold this row
+  // Only the parser thread copies row pointers, so use_count() == 1 means nobody else can see the row.
+  // use_count() is a relaxed load, the fence orders the writes to the row after the last reads of the render
+  //  thread, whose release of the row decremented the count with release semantics.
+  // The caller is going to change the row, it gets a new version.
+  Row &row_at(size_t index) {
+    auto &row = rows_[index];
+    if (row.use_count() > 1) {
+      row = std::make_shared<Row>(*row);
+    } else {
+      std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    row->touch();
+    return *row;
+  }
+
+  void fill_snapshot(ScreenSnapshot &snapshot) const {
+    snapshot.rows.clear();
+    snapshot.rows.reserve(max_rows_);
+    for (int i = 0; i < max_rows_; i++) {
+      snapshot.rows.push_back(rows_[row_index(i)]);
+    }
+    snapshot.max_rows = max_rows_;
+    snapshot.max_cols = max_cols_;
+    snapshot.cursor_row = cursor_row;
+    snapshot.cursor_col = cursor_col;
+    snapshot.cursor_show = cursor_show;
+    snapshot.cursor_blink = cursor_blink;
+    snapshot.cursor_color = cursor_color;
+    snapshot.cursor_fg_color = cursor_fg_color;
+    snapshot.attrs = current_attrs;
+    snapshot.scroll_offset = scroll_offset;
+    snapshot.alternate_screen = !scrollback_;
+    snapshot.buffer_rows = rows_.size();
+    // rows are allocated at their full width, the text of wide graphemes is not counted
+    snapshot.buffer_bytes = rows_.size() * (sizeof(Row) + max_cols_ * sizeof(Char));
   }
 
 
 // private:
-  Display *display_;
+  Session *session_;
 
   // screen buffer
-  std::vector<std::vector<Char>> rows_;
+  std::vector<std::shared_ptr<Row>> rows_;
   int max_cols_ = 80;
   int max_rows_ = 64;
   int current_screen_start_row = 0;
+  bool scrollback_ = true;
+  int64_t scroll_offset = 0;
 
   // current status
-  Color current_bg_color = Color{0xff000000}, current_fg_color = Color{0xffffffff};
+  CellColor current_bg_color = get_default_bg_color(), current_fg_color = get_default_fg_color();
   std::bitset<CHAR_ATTR_COUNT> current_attrs;
 
   // cursor position
   int cursor_row = 0, cursor_col = 0;
+  int saved_cursor_row = 0, saved_cursor_col = 0;
+
+  // graphemes, combining characters are appended to the cell written last
+  GraphemeBreaker grapheme_breaker;
+  int last_grapheme_row = 0, last_grapheme_col = -1, last_grapheme_end_col = 0;
+  static constexpr size_t max_grapheme_bytes = 64;
 
   // cursor rendering
-  int cursor_flip = 0;
-  std::chrono::high_resolution_clock::time_point cursor_last_time;
   Color cursor_color = ColorWhite, cursor_fg_color = ColorBrightBlack;
   bool cursor_blink = true;
   bool cursor_show = true;
-  std::chrono::milliseconds blink_interval = std::chrono::milliseconds(300);
 };
 
 }
@@ -0,0 +1,190 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <te/basic.hpp>
+#include <te/io_reactor.hpp>
+#include <te/latency_stats.hpp>
+#include <te/remote.hpp>
+#include <te/subprocess.hpp>
+#include <te/tty_input.hpp>
+
+namespace te {
+class Display;
+class Screen;
+struct ScreenSnapshot;
+
+// One terminal: the child process and its screens, fed by the I/O reactor worker the session is bound to.
+// A session renders nothing itself, the Display hosting it draws its snapshots into a pane with the window's
+//  shared renderer and glyph cache. Sessions of hidden tabs keep parsing but publish no snapshots.
+// A remote session has neither: it is attached to the session of a RemoteServer, its reactor worker applies the
+//  frames of the server instead of parsing, and its input and resizes are sent to the server.
+class Session {
+ public:
+  // display or server is notified of new snapshots, the other one is nullptr
+  Session(Display *display,
+          IOReactor &reactor,
+          std::ostream &log_stream,
+          LatencyStats &stats,
+          const std::vector<std::string> &args,
+          const std::vector<std::string> &envs,
+          int rows,
+          int cols,
+          int glyph_width,
+          int glyph_height,
+          bool verbose_log,
+          RemoteServer *server = nullptr);
+  // remote session attached to the server listening on server_socket_path
+  Session(Display *display,
+          IOReactor &reactor,
+          std::ostream &log_stream,
+          LatencyStats &stats,
+          const std::string &server_socket_path,
+          int rows,
+          int cols);
+
+  ~Session();
+
+  // reactor worker, the parser thread of the session
+  // parse data read from the tty
+  void receive(const char *data, size_t n);
+  // Apply a pending resize and publish the screens if they changed, after every batch of reads and on wakeup().
+  // caught_up: the tty had no more data, another thread woke the session up, or the worker publishes the screens
+  //  left unpublished. In throughput mode the screens are published only then, or once per publish_interval.
+  // true if the screens were left unpublished, the worker calls again with caught_up within publish_interval.
+  bool service(bool caught_up);
+  // the tty hung up / the pidfd of the child became readable
+  void hangup();
+  void child_exited();
+  // Move the output queued by write_to_tty() to the end of out. If there is none and the writer is idle, move
+  //  the next chunk of the paste instead. false if nothing was moved.
+  bool take_output(std::string &out, bool idle);
+  // remote session: apply the frames of the server
+  void receive_remote(const char *data, size_t n);
+  void publish_snapshot();
+  // tell the display or the server about a new snapshot or the exit
+  void notify() const;
+  void apply_pending_resize();
+  void process_osc(std::string_view osc);
+  void got_character(uint32_t cp);
+  void log_verbose_input_char(uint32_t c, bool has_color);
+  // save_cursor: DECSC on enter and DECRC on leave (?1049)
+  // clear: clear the alternate screen while switching (?1047, ?1049)
+  void switch_screen(bool alternate_screen, bool save_cursor, bool clear);
+
+  // render thread
+  // the latest published snapshot
+  std::shared_ptr<const ScreenSnapshot> snapshot() const {
+    return snapshot_.load();
+  }
+  // resize the screens on the parser thread
+  void resize(int rows, int cols);
+  // hidden sessions only parse, the snapshot is published again when the session is shown
+  void set_visible(bool visible);
+  // the child is gone, or its tty hung up. Without pidfds the child is polled.
+  bool exited() const {
+    return parser_done_ || child_exited_ ||
+           (subprocess_ && subprocess_->pid_fd() < 0 && subprocess_->check_exited());
+  }
+  bool remote() const {
+    return remote_fd_ >= 0;
+  }
+  bool parser_done() const {
+    return parser_done_;
+  }
+  bool throughput_mode() const {
+    return throughput_mode_;
+  }
+  // the socket of a remote session
+  int tty_fd() const {
+    return remote() ? remote_fd_ : subprocess_->tty_fd();
+  }
+  // any thread: the output is queued and written by the reactor worker, nothing blocks
+  // keystrokes and replies to the child, written before the rest of a paste
+  void write_pending_input_data(std::vector<uint8_t> &input_buffer);
+  void write_to_tty(std::string_view s);
+  // written in chunks, each once the tty took the previous one
+  void clipboard_paste(std::string_view clipboard_text);
+  void queue_paste(std::string_view data);
+  // bytes of the paste not written yet
+  size_t pending_paste() {
+    std::lock_guard lock(output_mutex_);
+    return paste_.size() - paste_offset_;
+  }
+  void wakeup();
+
+// private:
+  Display *display_;
+  RemoteServer *server_ = nullptr;
+  IOReactor &reactor_;
+  int reactor_worker_ = -1;
+  // the session waits in the wakeup queue of its worker
+  std::atomic<bool> reactor_wakeup_pending_ = false;
+
+  // screens, only touched by the parser thread after the constructor
+  Screen *current_screen_ = nullptr;
+  std::unique_ptr<Screen> default_screen_, alternate_screen_;
+  // size of the screens when they are created
+  int max_rows_, max_cols_;
+  int glyph_width_, glyph_height_;
+
+  // the latest screen published by the parser thread
+  std::atomic<std::shared_ptr<const ScreenSnapshot>> snapshot_;
+  // (rows << 32 | cols) requested by the render thread, 0 if none
+  std::atomic<uint64_t> pending_resize_ = 0;
+  uint64_t snapshot_version_ = 0;
+  // set by the parser thread when the tty hung up / the child is gone
+  std::atomic<bool> parser_done_ = false;
+  std::atomic<bool> child_exited_ = false;
+  // set by the render thread for sessions in a visible pane
+  std::atomic<bool> visible_ = true;
+  // the screens changed since the last published snapshot, parser thread
+  bool snapshot_stale_ = false;
+
+  // Flood control, parser thread. A session receiving more than throughput_mode_bytes per publish_interval
+  //  parses without publishing the screens the next frame would overwrite anyway, and publishes once per interval
+  //  or when it caught up with the tty. Below latency_mode_bytes it publishes after every read again.
+  static constexpr auto publish_interval = std::chrono::nanoseconds(1000000000 / 60);
+  static constexpr size_t throughput_mode_bytes = 16 * 1024, latency_mode_bytes = 4 * 1024;
+  std::atomic<bool> throughput_mode_ = false;
+  size_t rate_window_bytes_ = 0;
+  std::chrono::high_resolution_clock::time_point rate_window_start_, last_publish_;
+
+  // child process
+  TTYInput tty_input_;
+  // code points of the text decoded by tty_input_, reused between reads
+  std::vector<uint32_t> decoded_text_;
+  std::unique_ptr<Subprocess> subprocess_;
+  // written to the tty by the reactor worker, output_ first
+  static constexpr size_t paste_chunk_size = 4096;
+  std::mutex output_mutex_;
+  std::string output_;
+  std::string paste_;
+  size_t paste_offset_ = 0;
+
+  // remote session: the connection to the server and the frames received on it, reactor worker
+  int remote_fd_ = -1;
+  RemoteMessageReader remote_reader_;
+  RemoteFrameDecoder remote_decoder_;
+
+  // window title, owned by the parser thread and published with every snapshot
+  std::string window_title_ = "alex's te";
+  std::vector<std::string> xterm_title_stack_;
+
+  // palette, owned by the parser thread and published with every snapshot
+  std::shared_ptr<const Palette> palette_ = std::make_shared<const Palette>(Palette::default_palette());
+
+  // shared by all sessions of the display
+  LatencyStats &stats_;
+  std::ostream &log_stream_;
+  // trace every control sequence to the log and stdout, parser thread
+  const bool verbose_log_ = false;
+};
+
+}
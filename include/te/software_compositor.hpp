@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cinttypes>
+#include <vector>
+
+#include <te/basic.hpp>
+
+struct SDL_Texture;
+
+namespace te {
+
+// CPU renderer for hosts without a usable GPU.
+// Backgrounds and glyph alpha masks are composited into an ARGB framebuffer with SIMD blend kernels,
+//  only the rows changed since the last upload are copied to the streaming texture.
+class SoftwareCompositor {
+ public:
+  SoftwareCompositor();
+
+  // clears the framebuffer, everything becomes dirty
+  void resize(int w, int h);
+  int width() const {
+    return w_;
+  }
+  int height() const {
+    return h_;
+  }
+
+  void fill_rect(int x, int y, int w, int h, Color color);
+  // color with a constant alpha over the framebuffer
+  void blend_rect(int x, int y, int w, int h, Color color, uint8_t alpha);
+  // color with the coverage of mask (mask_w x mask_h, tightly packed), clipped to the box (x, y, clip_w, clip_h)
+  void blend_mask(int x, int y, int clip_w, int clip_h, const uint8_t *mask, int mask_w, int mask_h, Color color);
+  // move the pixels [x, x + w) of the rows [src_y, src_y + h) to dst_y
+  void move_rows(int x, int w, int src_y, int dst_y, int h);
+  // copy w pixels of h rows of pixels, stride pixels apart, to (x, y)
+  void copy_rows(int x, int y, int w, int h, const uint32_t *pixels, int stride);
+
+  // copy the dirty rows to texture, which must be a w x h ARGB8888 streaming texture
+  void upload(SDL_Texture *texture);
+
+  // blends n pixels of dst with color weighted by mask
+  using BlendSpan = void (*)(uint32_t *dst, const uint8_t *mask, int n, uint32_t color);
+
+ private:
+  void mark_dirty(int y, int h);
+
+  int w_ = 0, h_ = 0;
+  std::vector<uint32_t> pixels_;
+  // dirty pixel rows [dirty_begin_, dirty_end_)
+  int dirty_begin_ = 0, dirty_end_ = 0;
+  // best kernel the CPU supports
+  BlendSpan blend_span_;
+  // constant alpha mask for blend_rect
+  std::vector<uint8_t> const_mask_;
+};
+
+}
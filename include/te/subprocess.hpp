@@ -13,16 +13,25 @@ class Subprocess {
       std::vector<std::string> argv,
       std::vector<std::string> envs
   );
+  // hangs up the tty, the child gets SIGHUP and is reaped in the background
+  ~Subprocess();
 
   bool check_exited() const;
 
   int tty_fd() const {
     return tty_fd_;
   }
+  // readable once the child exits, -1 if the kernel has no pidfd_open
+  int pid_fd() const {
+    return pid_fd_;
+  }
 
  private:
   int tty_fd_ = -1;
   int child_pid_ = - 1;
+  int pid_fd_ = -1;
+  // reaped by check_exited()
+  mutable bool exited_ = false;
   std::string command_line_;
   std::vector<std::string> args_;
   std::vector<std::string> envs_;
@@ -15,10 +15,34 @@ enum class TTYInputType {
   UTF8,
 };
 
+// The kernels of TTYInput::decode_text(), public for the tests comparing the SIMD kernels to the scalar ones.
+struct UTF8Kernels {
+  // bytes up to the first control character
+  size_t (*text_length)(const uint8_t *s, size_t n);
+  // true if s is well-formed UTF-8 without a sequence cut at the end
+  bool (*validate)(const uint8_t *s, size_t n);
+  // decode well-formed s into out, returns the number of code points
+  size_t (*decode_valid)(const uint8_t *s, size_t n, uint32_t *out);
+
+  // simd: the fastest kernels the CPU supports, the scalar ones otherwise
+  explicit UTF8Kernels(bool simd);
+  static const UTF8Kernels &best();
+};
+
 class TTYInput {
  public:
   TTYInputType receive_char(char c);
 
+  // Text can be decoded with decode_text() in the Idle and UTF8 states.
+  bool accepts_text() const {
+    return input_state == InputState::Idle || input_state == InputState::UTF8;
+  }
+  // Decode the text at the start of data up to the first control character into code points, replacing
+  //  the existing content of codepoints. Malformed UTF-8 becomes U+FFFD. A sequence cut by the end of data
+  //  is kept in the UTF8 state and completed by the next call.
+  // Returns the number of bytes consumed, the next byte is a control character for receive_char().
+  size_t decode_text(const char *data, size_t size, std::vector<uint32_t> &codepoints);
+
   enum class InputState {
     Idle,
     Escape,
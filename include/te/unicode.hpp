@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cinttypes>
+#include <string>
+
+#include <te/unicode_tables.hpp>
+
+namespace te {
+
+// Grapheme_Cluster_Break property of UAX #29, CR and LF are Control since they never reach the screen
+// keep in sync with scripts/gen_unicode_tables.py
+enum GraphemeBreakClass {
+  GCB_OTHER = 0,
+  GCB_CONTROL,
+  GCB_EXTEND,
+  GCB_ZWJ,
+  GCB_REGIONAL_INDICATOR,
+  GCB_PREPEND,
+  GCB_SPACING_MARK,
+  GCB_L,
+  GCB_V,
+  GCB_T,
+  GCB_LV,
+  GCB_LVT,
+  GCB_EXTENDED_PICTOGRAPHIC,
+};
+
+// (grapheme break class << 2 | cell width), printable ASCII takes no table lookup
+constexpr uint8_t unicode_properties(uint32_t cp) {
+  if (cp - 0x20u < 0x5fu) {
+    return 1;
+  }
+  if (cp > 0x10ffffu) {
+    return 1;
+  }
+  constexpr uint32_t block_mask = (1u << unicode_block_bits) - 1;
+  return unicode_properties_stage2[(uint32_t) unicode_properties_stage1[cp >> unicode_block_bits] << unicode_block_bits
+      | (cp & block_mask)];
+}
+
+// cells a code point takes: 0 for combining characters, 2 for wide East Asian characters and emoji
+constexpr int codepoint_width(uint32_t cp) {
+  return unicode_properties(cp) & 3u;
+}
+
+constexpr GraphemeBreakClass grapheme_break_class(uint32_t cp) {
+  return static_cast<GraphemeBreakClass>(unicode_properties(cp) >> 2u);
+}
+
+// The grapheme cluster rules of UAX #29 fed one code point at a time.
+class GraphemeBreaker {
+ public:
+  // true if a new grapheme starts with a code point of class next
+  constexpr bool is_break(GraphemeBreakClass next) {
+    bool result = breaks_before(next);
+    // GB11: ExtPict Extend* ZWJ x ExtPict
+    if (next == GCB_EXTENDED_PICTOGRAPHIC) {
+      in_emoji_ = true;
+    } else if (next != GCB_EXTEND && !(next == GCB_ZWJ && in_emoji_)) {
+      in_emoji_ = false;
+    }
+    emoji_zwj_ = next == GCB_ZWJ && in_emoji_;
+    // GB12, GB13: regional indicators pair up
+    regional_indicators_ = next == GCB_REGIONAL_INDICATOR ? (result ? 1 : regional_indicators_ + 1) : 0;
+    prev_ = next;
+    return result;
+  }
+
+  // the next code point starts a grapheme
+  constexpr void reset() {
+    *this = GraphemeBreaker();
+  }
+
+ private:
+  constexpr bool breaks_before(GraphemeBreakClass next) const {
+    switch (prev_) {
+      case GCB_CONTROL:
+        // GB4
+        return true;
+      case GCB_PREPEND:
+        // GB9b
+        return next == GCB_CONTROL;
+      case GCB_L:
+        // GB6
+        if (next == GCB_L || next == GCB_V || next == GCB_LV || next == GCB_LVT) {
+          return false;
+        }
+        break;
+      case GCB_LV:
+      case GCB_V:
+        // GB7
+        if (next == GCB_V || next == GCB_T) {
+          return false;
+        }
+        break;
+      case GCB_LVT:
+      case GCB_T:
+        // GB8
+        if (next == GCB_T) {
+          return false;
+        }
+        break;
+      default:
+        break;
+    }
+    switch (next) {
+      case GCB_CONTROL:
+        // GB5
+        return true;
+      case GCB_EXTEND:
+      case GCB_ZWJ:
+      case GCB_SPACING_MARK:
+        // GB9, GB9a
+        return false;
+      case GCB_EXTENDED_PICTOGRAPHIC:
+        return !emoji_zwj_;
+      case GCB_REGIONAL_INDICATOR:
+        return regional_indicators_ % 2 == 0;
+      default:
+        // GB999
+        return true;
+    }
+  }
+
+  // GB1: break at the start
+  GraphemeBreakClass prev_ = GCB_CONTROL;
+  bool in_emoji_ = false;
+  bool emoji_zwj_ = false;
+  int regional_indicators_ = 0;
+};
+
+// first code point of an utf8 sequence, 0xfffd if invalid
+inline uint32_t utf8_decode(const std::string &s) {
+  if (s.empty()) {
+    return 0xfffd;
+  }
+  uint8_t b = s[0];
+  size_t n;
+  uint32_t cp;
+  if (b < 0x80u) {
+    return b;
+  } else if ((b & 0xe0u) == 0xc0u) {
+    n = 2;
+    cp = b & 0x1fu;
+  } else if ((b & 0xf0u) == 0xe0u) {
+    n = 3;
+    cp = b & 0x0fu;
+  } else if ((b & 0xf8u) == 0xf0u) {
+    n = 4;
+    cp = b & 0x07u;
+  } else {
+    return 0xfffd;
+  }
+  if (s.size() < n) {
+    return 0xfffd;
+  }
+  for (size_t i = 1; i < n; i++) {
+    cp = (cp << 6u) | ((uint8_t) s[i] & 0x3fu);
+  }
+  return cp;
+}
+
+// append the utf8 of cp to out
+inline void utf8_encode(uint32_t cp, std::string &out) {
+  if (cp < 0x80u) {
+    out.push_back((char) cp);
+  } else if (cp < 0x800u) {
+    out.push_back((char) (0xc0u | (cp >> 6u)));
+    out.push_back((char) (0x80u | (cp & 0x3fu)));
+  } else if (cp < 0x10000u) {
+    out.push_back((char) (0xe0u | (cp >> 12u)));
+    out.push_back((char) (0x80u | ((cp >> 6u) & 0x3fu)));
+    out.push_back((char) (0x80u | (cp & 0x3fu)));
+  } else {
+    out.push_back((char) (0xf0u | (cp >> 18u)));
+    out.push_back((char) (0x80u | ((cp >> 12u) & 0x3fu)));
+    out.push_back((char) (0x80u | ((cp >> 6u) & 0x3fu)));
+    out.push_back((char) (0x80u | (cp & 0x3fu)));
+  }
+}
+
+}
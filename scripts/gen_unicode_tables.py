@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+# Generate include/te/unicode_tables.hpp: cell width and grapheme cluster break class of every code point,
+#  as a two-level lookup table.
+#
+#   python3 scripts/gen_unicode_tables.py > include/te/unicode_tables.hpp
+#
+# The data comes from the unicodedata module of the Python running the script. It has no Grapheme_Cluster_Break
+#  or Extended_Pictographic property, both are derived from the general category and the ranges below,
+#  following UAX #29.
+
+import sys
+import unicodedata
+
+# keep in sync with GraphemeBreakClass in include/te/unicode.hpp
+GCB_OTHER, GCB_CONTROL, GCB_EXTEND, GCB_ZWJ, GCB_REGIONAL_INDICATOR, GCB_PREPEND, GCB_SPACING_MARK, \
+    GCB_L, GCB_V, GCB_T, GCB_LV, GCB_LVT, GCB_EXTENDED_PICTOGRAPHIC = range(13)
+
+BLOCK_BITS = 8
+BLOCK_SIZE = 1 << BLOCK_BITS
+MAX_CODEPOINT = 0x10ffff
+
+PREPEND = [(0x0600, 0x0605), (0x06dd, 0x06dd), (0x070f, 0x070f), (0x0890, 0x0891), (0x08e2, 0x08e2),
+           (0x0d4e, 0x0d4e), (0x110bd, 0x110bd), (0x110cd, 0x110cd), (0x111c2, 0x111c3), (0x1193f, 0x1193f),
+           (0x11941, 0x11941), (0x11a3a, 0x11a3a), (0x11a84, 0x11a89), (0x11d46, 0x11d46)]
+
+# emoji and pictographs, a superset of Extended_Pictographic outside the ASCII and Latin-1 ranges
+EXTENDED_PICTOGRAPHIC = [(0x00a9, 0x00a9), (0x00ae, 0x00ae), (0x203c, 0x203c), (0x2049, 0x2049),
+                         (0x2122, 0x2122), (0x2139, 0x2139), (0x2194, 0x2199), (0x21a9, 0x21aa),
+                         (0x231a, 0x231b), (0x2328, 0x2328), (0x2388, 0x2388), (0x23cf, 0x23cf),
+                         (0x23e9, 0x23f3), (0x23f8, 0x23fa), (0x24c2, 0x24c2), (0x25aa, 0x25ab),
+                         (0x25b6, 0x25b6), (0x25c0, 0x25c0), (0x25fb, 0x25fe), (0x2600, 0x27bf),
+                         (0x2934, 0x2935), (0x2b05, 0x2b07), (0x2b1b, 0x2b1c), (0x2b50, 0x2b50),
+                         (0x2b55, 0x2b55), (0x3030, 0x3030), (0x303d, 0x303d), (0x3297, 0x3297),
+                         (0x3299, 0x3299), (0x1f000, 0x1f0ff), (0x1f10d, 0x1f10f), (0x1f12f, 0x1f12f),
+                         (0x1f16c, 0x1f171), (0x1f17e, 0x1f17f), (0x1f18e, 0x1f18e), (0x1f191, 0x1f19a),
+                         (0x1f1ad, 0x1f1e5), (0x1f201, 0x1f20f), (0x1f21a, 0x1f21a), (0x1f22f, 0x1f22f),
+                         (0x1f232, 0x1f23a), (0x1f23c, 0x1f23f), (0x1f249, 0x1f3fa), (0x1f400, 0x1f53d),
+                         (0x1f546, 0x1f64f), (0x1f680, 0x1f6ff), (0x1f774, 0x1f77f), (0x1f7d5, 0x1f7ff),
+                         (0x1f80c, 0x1f80f), (0x1f848, 0x1f84f), (0x1f85a, 0x1f85f), (0x1f888, 0x1f88f),
+                         (0x1f8ae, 0x1f8ff), (0x1f90c, 0x1f93a), (0x1f93c, 0x1f945), (0x1f947, 0x1faff),
+                         (0x1fc00, 0x1fffd)]
+
+# unassigned code points of these ranges are wide
+WIDE_RANGES = [(0x3400, 0x4dbf), (0x4e00, 0x9fff), (0xf900, 0xfaff), (0x20000, 0x2fffd), (0x30000, 0x3fffd)]
+
+
+def in_ranges(cp, ranges):
+    return any(first <= cp <= last for first, last in ranges)
+
+
+def grapheme_break_class(cp):
+    category = unicodedata.category(chr(cp))
+    if cp == 0x200d:
+        return GCB_ZWJ
+    if cp == 0x200c or 0x1f3fb <= cp <= 0x1f3ff or 0xe0020 <= cp <= 0xe007f or category in ('Mn', 'Me'):
+        return GCB_EXTEND
+    if category in ('Cc', 'Cf', 'Zl', 'Zp') and not in_ranges(cp, PREPEND):
+        return GCB_CONTROL
+    if 0x1f1e6 <= cp <= 0x1f1ff:
+        return GCB_REGIONAL_INDICATOR
+    if in_ranges(cp, PREPEND):
+        return GCB_PREPEND
+    if category == 'Mc':
+        return GCB_SPACING_MARK
+    if 0x1100 <= cp <= 0x115f or 0xa960 <= cp <= 0xa97c:
+        return GCB_L
+    if 0x1160 <= cp <= 0x11a7 or 0xd7b0 <= cp <= 0xd7c6:
+        return GCB_V
+    if 0x11a8 <= cp <= 0x11ff or 0xd7cb <= cp <= 0xd7fb:
+        return GCB_T
+    if 0xac00 <= cp <= 0xd7a3:
+        return GCB_LV if (cp - 0xac00) % 28 == 0 else GCB_LVT
+    if in_ranges(cp, EXTENDED_PICTOGRAPHIC):
+        return GCB_EXTENDED_PICTOGRAPHIC
+    return GCB_OTHER
+
+
+def width(cp):
+    category = unicodedata.category(chr(cp))
+    if cp == 0 or category in ('Cc', 'Mn', 'Me', 'Zl', 'Zp') or (category == 'Cf' and cp != 0x00ad):
+        return 0
+    if 0x1160 <= cp <= 0x11ff or 0xd7b0 <= cp <= 0xd7ff or cp == 0x200b:
+        # Hangul medial vowels and final consonants join the initial consonant
+        return 0
+    if unicodedata.east_asian_width(chr(cp)) in ('W', 'F') or (category == 'Cn' and in_ranges(cp, WIDE_RANGES)):
+        return 2
+    return 1
+
+
+def main():
+    blocks = {}
+    stage1 = []
+    stage2 = []
+    for block_start in range(0, MAX_CODEPOINT + 1, BLOCK_SIZE):
+        block = tuple(width(cp) | grapheme_break_class(cp) << 2
+                      for cp in range(block_start, block_start + BLOCK_SIZE))
+        if block not in blocks:
+            blocks[block] = len(blocks)
+            stage2.extend(block)
+        stage1.append(blocks[block])
+    assert len(blocks) <= 256
+
+    out = sys.stdout
+    out.write('#pragma once\n\n')
+    out.write('// Generated by scripts/gen_unicode_tables.py from Unicode %s, do not edit.\n\n' % unicodedata.unidata_version)
+    out.write('#include <cinttypes>\n\n')
+    out.write('namespace te {\n\n')
+    out.write('// code point -> (grapheme break class << 2 | cell width)\n')
+    out.write('//  unicode_properties_stage2[unicode_properties_stage1[cp >> %d] << %d | (cp & 0x%x)]\n\n'
+              % (BLOCK_BITS, BLOCK_BITS, BLOCK_SIZE - 1))
+    out.write('constexpr int unicode_block_bits = %d;\n\n' % BLOCK_BITS)
+    for name, values in (('unicode_properties_stage1', stage1), ('unicode_properties_stage2', stage2)):
+        out.write('constexpr uint8_t %s[%d] = {\n' % (name, len(values)))
+        for i in range(0, len(values), 24):
+            out.write('    ' + ', '.join('%d' % v for v in values[i:i + 24]) + ',\n')
+        out.write('};\n\n')
+    out.write('}\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -1,17 +1,16 @@
 #include <te/display.hpp>
 
-#include <cmath>
+#include <cstring>
 
+#include <algorithm>
 #include <filesystem>
-#include <iomanip>
 #include <iostream>
-#include <span>
+#include <sstream>
 #include <string>
 #include <string_view>
 #include <unordered_set>
 
 #include <unistd.h>
-#include <sys/ioctl.h>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_rect.h>
@@ -22,251 +21,179 @@
 #include <SDL2/SDL_image.h>
 
 #include <te/font_cache.hpp>
+#include <te/latency_bench.hpp>
 #include <te/screen.hpp>
+#include <te/software_compositor.hpp>
 #include <te/subprocess.hpp>
+#include <te/unicode.hpp>
 
 namespace te {
-void set_tty_window_size(int tty_fd, int cols, int rows, int res_w, int res_h) {
-  winsize screen_size;
-  screen_size.ws_col = cols;
-  screen_size.ws_row = rows;
-  screen_size.ws_xpixel = res_w;
-  screen_size.ws_ypixel = res_h;
-
-  if (ioctl(tty_fd, TIOCSWINSZ, &screen_size) < 0) {
-    perror("ioctl TIOCSWINSZ");
-    abort();
-  }
+
+
+static Color invert_color(Color color) {
+  color.r = 0xff - color.r;
+  color.g = 0xff - color.g;
+  color.b = 0xff - color.b;
+  return color;
 }
 
+static Color faint_color(Color color) {
+  color.r /= 2;
+  color.g /= 2;
+  color.b /= 2;
+  return color;
+}
 
+// reverse video of the pane being rendered
 Color Display::map_color(Color color) const {
-  if (current_screen_->current_attrs.test(CHAR_ATTR_REVERSE_VIDEO)) {
-    color.r = 0x100 - color.r;
-    color.g = 0x100 - color.g;
-    color.b = 0x100 - color.b;
+  if (lut_reverse_video_) {
+    color = invert_color(color);
   }
 
   return color;
 }
 
-void Display::write_pending_input_data(std::vector<uint8_t> &input_buffer) {
+// truecolor cells skip the tables, bold does not change them
+Color Display::resolve_rgb_color(CellColor color, int variant) const {
+  Color result{0xff000000u | color.index()};
+  if (variant & COLOR_VARIANT_FAINT) {
+    result = faint_color(result);
+  }
+  return map_color(result);
+}
 
-  if (!input_buffer.empty()) {
-    int total_write = 0;
-    while (total_write < input_buffer.size()) {
-      int nwrite = write(subprocess_->tty_fd(), input_buffer.data(), input_buffer.size());
-      if (nwrite < 0) {
-        if (!(errno == EAGAIN || errno == EWOULDBLOCK)) {
-          perror("write");
-          abort();
+// Rebuild the color tables when the palette or reverse video of the pane differs from the previous pane.
+// Cells store palette indexes, so a theme change only rebuilds the tables and renders the cached rows of the
+//  pane again, the screen is not touched. Panes of sessions with the default palette share the tables.
+void Display::update_color_lut(Pane &pane) {
+  const auto &snapshot = *pane.frame_snapshot;
+  bool reverse_video = snapshot.attrs.test(CHAR_ATTR_REVERSE_VIDEO);
+  if (snapshot.palette->version != lut_palette_version_ || reverse_video != lut_reverse_video_) {
+    lut_palette_version_ = snapshot.palette->version;
+    lut_reverse_video_ = reverse_video;
+
+    const auto &colors = snapshot.palette->colors;
+    for (int variant = 0; variant < COLOR_VARIANT_COUNT; variant++) {
+      for (int i = 0; i < PALETTE_SIZE; i++) {
+        // bold shows the first 8 colors in their bright version
+        Color color = colors[(variant & COLOR_VARIANT_BOLD) && i < 8 ? i + 8 : i];
+        if (variant & COLOR_VARIANT_FAINT) {
+          color = faint_color(color);
         }
-      } else {
-        total_write += nwrite;
+        color_lut_[variant][i] = reverse_video ? invert_color(color) : color;
       }
     }
-    input_buffer.clear();
   }
-}
-
-void hexdump(std::ostream &os, std::span<const char> data) {
-  int width = 16;
-  std::stringstream ss_hex, ss_s;
-  int addr_width = ceil(log2(data.size()) / 4);
-  os << "0x" << std::hex << std::setw(addr_width) << std::setfill('0') << 0 << " ";
-  for (size_t i = 0; i < data.size(); i++) {
-    ss_hex << std::hex << std::setw(2) << std::setfill('0') << (int)(uint8_t) data[i] << ' ';
-    if (std::isprint(data[i])) {
-      ss_s << data[i];
-    } else {
-      ss_s << '.';
-    }
 
-    if (i % width == width - 1) {
-      os << ss_hex.str() << " | " << ss_s.str() << std::endl;
-      os << "0x" << std::hex << std::setw(addr_width) << std::setfill('0') << i << " ";
-      ss_hex.str("");
-      ss_hex.clear();
-      ss_s.str("");
-      ss_s.clear();
-    }
+  if (snapshot.palette->version == pane.lut_palette_version && reverse_video == pane.lut_reverse_video) {
+    return;
   }
-
-  auto rest = data.size() % width;
-  if (rest > 0) {
-    os << ss_hex.str();
-    for (int i = 0; i < width - rest; i++) {
-      os << "   ";
+  pane.lut_palette_version = snapshot.palette->version;
+  pane.lut_reverse_video = reverse_video;
+  // the cached rows of the pane have the old colors, row versions belong to one session
+  for (auto &row : snapshot.rows) {
+    auto it = row_textures_.find(row->version());
+    if (it != row_textures_.end()) {
+      it->second.complete = false;
     }
-    os << " | " << ss_s.str();
-    for (int i = 0; i < width - rest; i++) {
-      os << '.';
-    }
-    os << std::endl;
   }
+  pane.frame_row_versions.clear();
 }
 
-constexpr const char* escape_table[] = {
-    "\\0",0,0,0,  0,0,0,"\\a", "\\b","\\t","\\n","\\v", "\\f","\\r",0,0,
-};
-
-void Display::process_input() {
-  bool verbose_read = true;
-  bool has_color = true;
-
-  std::array<char, 1024> input_buffer; // NOLINT(cppcoreguidelines-pro-type-member-init)
-
-  int nread = read(subprocess_->tty_fd(), input_buffer.data(), input_buffer.size());
-  for (int i = 0; i < nread; i++) {
-    uint32_t c = (uint8_t)input_buffer[i];
-    auto input_type = tty_input_.receive_char(input_buffer[i]);
-
-    if (input_type == TTYInputType::Char) {
-      if (verbose_read) {
-        log_verbose_input_char(c, has_color);
-      }
-      if (c == '\n' || c == '\f') {
-        // https://invisible-island.net/xterm/ctlseqs/ctlseqs.html
-        //  Form Feed or New Page (NP ).  (FF  is Ctrl-L).  FF  is treated the same as LF.
-        current_screen_->new_line();
-      } else if (c == 0x0f) {
-        // switch to standard char set
-      } else if (c == '\r') {
-        // carriage return
-        current_screen_->cursor_col = 0;
-      } else if (c == '\a') {
-//        std::cout << "alarm" << std::endl;
-      } else if (c == '\b') {
-//        std::cout << "back space" << std::endl;
-        if (current_screen_->cursor_col == 0) {
-          if (current_screen_->cursor_row == 0) {
-            // nothing
-          } else {
-            current_screen_->cursor_col = max_cols_ - 1;
-            current_screen_->cursor_row--;
-          }
-        } else {
-          current_screen_->cursor_col--;
-        }
-      } else if (c == 0x0f || c == 0x0e) {
-        if (c == 0x0f) {
-          // select G0 character set
-        } else {
-          std::cerr << "Warning, we do not support G1 character set";
-        }
-      } else if (c < 0x20) {
-        // ignore unknown control characters
-      } else {
-        got_character(std::string(1, c));
-      }
-    } else if (input_type == TTYInputType::CSI) {
-      auto ok = current_screen_->process_csi(tty_input_.buffer_);
-      if (!ok) {
-        std::cout << "unknown csi seq ESC [ ";
-        for (auto c : tty_input_.buffer_) {
-          std::cout << c;
-        }
-        std::cout << std::endl;
-        hexdump(std::cout, tty_input_.buffer_);
-      } else {
-        if (verbose_read) {
-          std::cout << "csi seq ESC [ ";
-          for (auto c : tty_input_.buffer_) {
-            std::cout << c;
-          }
-          std::cout << std::endl;
-          hexdump(std::cout, tty_input_.buffer_);
-
-        }
-      }
-      if (verbose_read) {
-        if (has_color) {
-          log_stream_ << "\x1b[33m{\x1b[32m";
-        } else {
-          log_stream_ << "{";
-        }
-        log_stream_ << "CSI ";
-        log_stream_.write((const char*)tty_input_.buffer_.data(), tty_input_.buffer_.size());
-        if (has_color) {
-          log_stream_ << "\x1b[33m}\x1b[0m";
-        } else {
-          log_stream_ << "}";
-        }
-        log_stream_.flush();
-      }
-    } else if (input_type == TTYInputType::TerminatedByST) {
-      if (verbose_read) {
-        std::cout << "TerminatedByST: " << std::endl;
-        hexdump(std::cout, tty_input_.buffer_);
-
-        if (has_color) {
-          log_stream_ << "\x1b[33m{\x1b[32m";
-        } else {
-          log_stream_ << "{";
-        }
-        log_stream_ << "ESC ";
-        log_stream_.write((const char*)tty_input_.buffer_.data(), tty_input_.buffer_.size());
-        if (has_color) {
-          log_stream_ << "\x1b[33m}\x1b[0m";
-        } else {
-          log_stream_ << "}";
-        }
-        log_stream_.flush();
-      }
-      const auto &b = tty_input_.buffer_;
-      if (!b.empty()) {
-        if (b[0] == ']') {
-          // OSC: Operating System Control
-          if (b.size() >= 3 && b[1] == '0' && b[2] == ';') {
-            // set title
-            window_title_ = std::string(reinterpret_cast<const char *>(b.data() + 3), b.size() - 3);
-            SDL_SetWindowTitle(window_, window_title_.c_str());
-          }
-        }
-      }
-    } else if (input_type == TTYInputType::UTF8) {
-      if (has_color) {
-        log_stream_ << "\x1b[33m{\x1b[32m";
-      } else {
-        log_stream_ << "{";
-      }
-      log_stream_ << "u ";
-      for (auto n : tty_input_.buffer_) {
-        log_stream_ << "\\x" << std::hex << std::setfill('0') << std::setw(2) << (uint32_t)(uint8_t)n;
-      }
-      if (has_color) {
-        log_stream_ << "\x1b[33m}\x1b[0m";
-      } else {
-        log_stream_ << "}";
-      }
-      log_stream_.flush();
-
-      got_character(tty_input_.buffer_);
-
-    }
+// The window is cleared with the default background of the focused pane.
+void Display::update_clear_color(const ScreenSnapshot &snapshot) {
+  Color clear_color = snapshot.palette->colors[PALETTE_DEFAULT_BG];
+  if (snapshot.attrs.test(CHAR_ATTR_REVERSE_VIDEO)) {
+    clear_color = invert_color(clear_color);
+  }
+  if (clear_color.u32 == clear_color_.u32) {
+    return;
+  }
+  clear_color_ = clear_color;
+  // rows skip the backgrounds of the clear color
+  clear_row_textures();
+  for (auto &tab : tabs_) {
+    for_each_pane(*tab.root, [](Pane &pane) { pane.frame_row_versions.clear(); });
   }
+  // the background layer is blended over the clear color
+  background_layer_w_ = background_layer_h_ = 0;
+  layout_damaged_ = true;
 }
-void Display::render_background_image() {
-  // default tiling mode
-  int cols = ceil((double) resolution_w_ / background_image_width),
-      rows = ceil((double) resolution_h_ / background_image_height);
 
+// Pick up the decoded background image, and tile it over a window sized layer when it arrives or the window
+//  is resized. The layer is blended over the clear color once, so each frame copies it as is.
+void Display::update_background_layer() {
+  if (background_image_future_.valid() &&
+      background_image_future_.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+    background_image_surface = background_image_future_.get();
+    background_layer_w_ = background_layer_h_ = 0;
+    // rows rendered before skipped the backgrounds of the clear color, which now dim the image
+    clear_row_textures();
+  }
+  if (!background_image_surface
+      || (background_layer_w_ == resolution_w_ && background_layer_h_ == resolution_h_)) {
+    return;
+  }
+  int w = resolution_w_, h = resolution_h_;
+  int image_w = background_image_surface->w, image_h = background_image_surface->h;
+  // if we have enough space for one complete image, center the tiles
   int pad_w = 0, pad_h = 0;
-  // if we have enough space for one complete image, add padding
-  if (resolution_w_ >= background_image_width && resolution_h_ >= background_image_height) {
-    pad_h = resolution_h_ % background_image_height / 2;
-    pad_w = resolution_w_ % background_image_width / 2;
+  if (w >= image_w && h >= image_h) {
+    pad_h = h % image_h / 2;
+    pad_w = w % image_w / 2;
   }
-  for (int row = -1; row < rows; row++) {
-    for (int col = -1; col < cols; col++) {
-      SDL_Rect dst{
-          background_image_width * col + pad_w, background_image_height * row + pad_h, background_image_width,
-          background_image_height
-      };
-      SDL_Rect src{0, 0, background_image_width, background_image_height};
-      SDL_RenderCopy(renderer_, background_image_texture, &src, &dst);
+  // the image blended over the clear color once, then tiled row by row
+  std::vector<Color> tile((size_t) image_w * image_h);
+  auto pixels = static_cast<const uint8_t*>(background_image_surface->pixels);
+  for (int y = 0; y < image_h; y++) {
+    auto image_row = reinterpret_cast<const Color*>(pixels + (size_t) y * background_image_surface->pitch);
+    for (int x = 0; x < image_w; x++) {
+      Color pixel = image_row[x];
+      Color &out = tile[(size_t) y * image_w + x];
+      out.a = 0xff;
+      out.r = (pixel.r * pixel.a + clear_color_.r * (255 - pixel.a)) / 255;
+      out.g = (pixel.g * pixel.a + clear_color_.g * (255 - pixel.a)) / 255;
+      out.b = (pixel.b * pixel.a + clear_color_.b * (255 - pixel.a)) / 255;
     }
   }
+  background_layer_.resize((size_t) w * h);
+  int x0 = ((-pad_w) % image_w + image_w) % image_w;
+  for (int y = 0; y < h; y++) {
+    auto out = background_layer_.data() + (size_t) y * w;
+    if (y >= image_h) {
+      // the same as the row one tile up
+      memcpy(out, out - (size_t) image_h * w, w * sizeof(Color));
+      continue;
+    }
+    int image_y = ((y - pad_h) % image_h + image_h) % image_h;
+    auto tile_row = tile.data() + (size_t) image_y * image_w;
+    for (int x = 0, image_x = x0; x < w;) {
+      int n = std::min(w - x, image_w - image_x);
+      memcpy(out + x, tile_row + image_x, n * sizeof(Color));
+      x += n;
+      image_x = 0;
+    }
+  }
+  background_layer_w_ = w;
+  background_layer_h_ = h;
+
+  if (!software_compositor_) {
+    if (background_texture_) {
+      SDL_DestroyTexture(background_texture_);
+    }
+    background_texture_ = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, w, h);
+    if (!background_texture_ || SDL_UpdateTexture(background_texture_, nullptr, background_layer_.data(), w * 4) != 0) {
+      std::cerr << "Failed to create background texture: " << SDL_GetError() << std::endl;
+      abort();
+    }
+    // opaque, copied as is
+    SDL_SetTextureBlendMode(background_texture_, SDL_BLENDMODE_NONE);
+  }
+  // every row shows a different slice now
+  for (auto &tab : tabs_) {
+    for_each_pane(*tab.root, [](Pane &pane) { pane.frame_row_versions.clear(); });
+  }
+  layout_damaged_ = true;
 }
 
 char shift_table[] = {
@@ -296,38 +223,346 @@ static std::unordered_set<char> SDLInputLiterals = {
 void Display::resize(int w, int h) {
   resolution_h_ = h;
   resolution_w_ = w;
-  max_cols_ = resolution_w_ / glyph_width_;
-  max_rows_ = resolution_h_ / glyph_height_;
-  set_tty_window_size(subprocess_->tty_fd(), max_cols_, max_rows_, resolution_w_, resolution_h_);
+  layout();
+}
+
+// The tab bar takes the top row when there is more than one tab, the panes of every tab share the rest of the
+//  window. Sessions of hidden tabs are resized too, so they are laid out when they are shown.
+void Display::layout() {
+  int top = tabs_.size() > 1 ? glyph_height_ : 0;
+  for (size_t i = 0; i < tabs_.size(); i++) {
+    if (i != active_tab_) {
+      layout_split(*tabs_[i].root, 0, top, resolution_w_, resolution_h_ - top);
+    }
+  }
+  // only the separators of the active tab are drawn
+  separators_.clear();
+  if (active_tab_ < tabs_.size()) {
+    layout_split(*tabs_[active_tab_].root, 0, top, resolution_w_, resolution_h_ - top);
+  }
+  layout_damaged_ = true;
+  update_visibility();
+}
+
+void Display::layout_split(Split &split, int x, int y, int w, int h) {
+  if (split.pane) {
+    auto &pane = *split.pane;
+    pane.x = x;
+    pane.y = y;
+    // the rows show another slice of the background
+    pane.frame_row_versions.clear();
+    int rows = std::max(1, h / glyph_height_), cols = std::max(1, w / glyph_width_);
+    if (rows != pane.rows || cols != pane.cols) {
+      pane.rows = rows;
+      pane.cols = cols;
+      // the screens are resized by the parser thread
+      if (pane.session) {
+        pane.session->resize(rows, cols);
+      }
+    }
+    return;
+  }
+  if (split.side_by_side) {
+    int first_w = std::max(0, (w - separator_width_) / 2);
+    layout_split(*split.first, x, y, first_w, h);
+    separators_.emplace_back(x + first_w, y, separator_width_, h);
+    layout_split(*split.second, x + first_w + separator_width_, y, w - first_w - separator_width_, h);
+  } else {
+    int first_h = std::max(0, (h - separator_width_) / 2);
+    layout_split(*split.first, x, y, w, first_h);
+    separators_.emplace_back(x, y + first_h, w, separator_width_);
+    layout_split(*split.second, x, y + first_h + separator_width_, w, h - first_h - separator_width_);
+  }
+}
+
+void Display::update_visibility() {
+  for (size_t i = 0; i < tabs_.size(); i++) {
+    bool visible = window_visible_ && i == active_tab_;
+    for_each_pane(*tabs_[i].root, [&](Pane &pane) {
+      if (pane.session) {
+        pane.session->set_visible(visible);
+      }
+    });
+  }
+}
+
+// the leaf holding pane, nullptr if it is not in split
+Display::Split *Display::find_split(Split &split, const Pane *pane) {
+  if (split.pane) {
+    return split.pane.get() == pane ? &split : nullptr;
+  }
+  if (auto leaf = find_split(*split.first, pane)) {
+    return leaf;
+  }
+  return find_split(*split.second, pane);
+}
 
-  default_screen_->resize(max_rows_, max_cols_);
-  alternate_screen_->resize(max_rows_, max_cols_);
+Display::Pane *Display::pane_at(int x, int y) {
+  Pane *result = nullptr;
+  for_each_pane(*tabs_[active_tab_].root, [&](Pane &pane) {
+    if (pane.x <= x && x < pane.x + glyph_width_ * pane.cols && pane.y <= y && y < pane.y + glyph_height_ * pane.rows) {
+      result = &pane;
+    }
+  });
+  return result;
+}
+
+// the pane is laid out before its session starts, so the child starts with the right window size
+void Display::open_session(Pane &pane) {
+  bool first = sessions_opened_++ == 0;
+  if (first && !attach_socket_path_.empty()) {
+    // the other panes run their own sessions, detached with the window
+    pane.session = std::make_unique<Session>(this, *reactor_, null_log_stream_, stats_, attach_socket_path_,
+                                             pane.rows, pane.cols);
+    pane.session->set_visible(window_visible_);
+    return;
+  }
+  // the log would interleave the output of all sessions, only the first one is logged
+  auto &log_stream = first ? log_stream_ : null_log_stream_;
+  pane.session = std::make_unique<Session>(this, *reactor_, log_stream, stats_, args_, envs_, pane.rows, pane.cols,
+                                           glyph_width_, glyph_height_, first && verbose_log_);
+  pane.session->set_visible(window_visible_);
 }
+
+void Display::new_tab() {
+  auto &tab = tabs_.emplace_back();
+  tab.root = std::make_unique<Split>();
+  tab.root->pane = std::make_unique<Pane>();
+  tab.focused = tab.root->pane.get();
+  auto &pane = *tab.focused;
+  switch_tab(tabs_.size() - 1);
+  open_session(pane);
+}
+
+// the focused pane and a new one share its place
+void Display::split_pane(bool side_by_side) {
+  auto &tab = tabs_[active_tab_];
+  Split *leaf = find_split(*tab.root, tab.focused);
+  leaf->first = std::make_unique<Split>();
+  leaf->first->pane = std::move(leaf->pane);
+  leaf->first->parent = leaf;
+  leaf->second = std::make_unique<Split>();
+  leaf->second->pane = std::make_unique<Pane>();
+  leaf->second->parent = leaf;
+  leaf->side_by_side = side_by_side;
+  tab.focused = leaf->second->pane.get();
+  clear_selection();
+  layout();
+  open_session(*tab.focused);
+}
+
+// The sibling of the pane takes its place, a tab without panes is closed.
+void Display::close_pane(Pane *pane) {
+  for (size_t i = 0; i < tabs_.size(); i++) {
+    auto &tab = tabs_[i];
+    Split *leaf = find_split(*tab.root, pane);
+    if (!leaf) {
+      continue;
+    }
+    clear_selection();
+    clear_frame_textures(*pane);
+    if (!leaf->parent) {
+      tabs_.erase(tabs_.begin() + i);
+      if (active_tab_ > i || active_tab_ == tabs_.size()) {
+        active_tab_ = std::max<size_t>(active_tab_, 1) - 1;
+      }
+    } else {
+      bool focused = tab.focused == pane;
+      Split *parent = leaf->parent;
+      auto sibling = std::move(parent->first.get() == leaf ? parent->second : parent->first);
+      // the leaf and its session go with the old children of parent
+      parent->pane = std::move(sibling->pane);
+      parent->side_by_side = sibling->side_by_side;
+      parent->first = std::move(sibling->first);
+      parent->second = std::move(sibling->second);
+      if (!parent->pane) {
+        parent->first->parent = parent;
+        parent->second->parent = parent;
+      }
+      if (focused) {
+        tab.focused = nullptr;
+        for_each_pane(*parent, [&](Pane &p) {
+          if (!tab.focused) {
+            tab.focused = &p;
+          }
+        });
+      }
+    }
+    layout();
+    return;
+  }
+}
+
+// panes of hidden tabs keep their session but no textures
+void Display::switch_tab(size_t index) {
+  if (index >= tabs_.size()) {
+    return;
+  }
+  if (index != active_tab_ && active_tab_ < tabs_.size()) {
+    for_each_pane(*tabs_[active_tab_].root, [&](Pane &pane) { clear_frame_textures(pane); });
+  }
+  active_tab_ = index;
+  clear_selection();
+  layout();
+}
+
+void Display::focus_next_pane() {
+  auto &tab = tabs_[active_tab_];
+  std::vector<Pane*> panes;
+  for_each_pane(*tab.root, [&](Pane &pane) { panes.push_back(&pane); });
+  auto it = std::find(panes.begin(), panes.end(), tab.focused);
+  tab.focused = panes[(it - panes.begin() + 1) % panes.size()];
+  clear_selection();
+}
+
+// any thread: wake up the render thread, which decides in next_frame_deadline() what to draw
+void Display::request_redraw() {
+  if (!redraw_event_pending_.exchange(true)) {
+    SDL_Event event{};
+    event.type = redraw_event_type_;
+    SDL_PushEvent(&event);
+  }
+}
+
+// When the render thread should draw the next frame, time_point::max() if nothing needs to be drawn.
+// damaged: window or selection changes since the last frame
+std::chrono::high_resolution_clock::time_point Display::next_frame_deadline(bool damaged) const {
+  using clock = std::chrono::high_resolution_clock;
+  if (!window_visible_) {
+    return clock::time_point::max();
+  }
+  auto deadline = clock::time_point::max();
+  // glyphs and the background image arrive from worker threads, the image pushes a redraw event when decoded
+  bool background_ready = background_image_future_.valid()
+      && background_image_future_.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+  if (damaged || font_cache_->has_pending() || background_ready) {
+    deadline = last_present_time_ + frame_interval_;
+  }
+  // only the panes on screen are drawn, sessions of hidden tabs publish no snapshots
+  for_each_pane(*tabs_[active_tab_].root, [&](const Pane &pane) {
+    auto snapshot = pane.session->snapshot();
+    if (snapshot->version != pane.rendered_version) {
+      deadline = std::min(deadline, last_present_time_ + frame_interval_);
+    }
+    if (snapshot->cursor_show && snapshot->cursor_blink) {
+      deadline = std::min(deadline, cursor_last_time_ + blink_interval_);
+    }
+  });
+  if (latency_bench_) {
+    deadline = std::min(deadline, std::max(latency_bench_->next_wakeup(), last_present_time_ + frame_interval_));
+  }
+  if (hud_visible_) {
+    deadline = std::min(deadline, hud_last_update_ + hud_interval_);
+  }
+  return deadline;
+}
+
+// frames are capped to the refresh rate of the window's display
+void Display::update_frame_interval() {
+  SDL_DisplayMode mode;
+  int refresh_rate = 60;
+  if (SDL_GetWindowDisplayMode(window_, &mode) == 0 && mode.refresh_rate > 0) {
+    refresh_rate = mode.refresh_rate;
+  }
+  frame_interval_ = std::chrono::nanoseconds(1000000000 / refresh_rate);
+}
+
 void Display::loop() {
 
   SDL_Event event;
-  std::chrono::high_resolution_clock::time_point last_t;
   std::vector<uint8_t> input_buffer;
+  // the first frame is drawn right away
+  bool damaged = true;
 
   while (true) {
+    // sleep until an event arrives or the next frame is due
+    auto deadline = next_frame_deadline(damaged);
+    bool parser_done = false;
+    for (auto &tab : tabs_) {
+      for_each_pane(*tab.root, [&](Pane &pane) { parser_done = parser_done || pane.session->parser_done(); });
+    }
+    if (parser_done) {
+      // the child may not be reapable yet when its tty hangs up
+      deadline = std::min(deadline, std::chrono::high_resolution_clock::now() + std::chrono::milliseconds(100));
+    }
+    int timeout_ms = -1;
+    if (deadline != std::chrono::high_resolution_clock::time_point::max()) {
+      auto wait = deadline - std::chrono::high_resolution_clock::now();
+      timeout_ms = std::max<int64_t>(0, std::chrono::ceil<std::chrono::milliseconds>(wait).count());
+    }
+    bool has_event = timeout_ms < 0 ? SDL_WaitEvent(&event) : SDL_WaitEventTimeout(&event, timeout_ms);
+
     bool has_input = false;
     auto t0 = std::chrono::high_resolution_clock::now();
+    auto selection = std::make_tuple(has_selection,
+                                     selection_start_row,
+                                     selection_start_col,
+                                     selection_end_row,
+                                     selection_end_col);
     // Process SDL events
-    while (SDL_PollEvent(&event)) {
+    for (; has_event; has_event = SDL_PollEvent(&event)) {
+      if (event.type == redraw_event_type_) {
+        redraw_event_pending_ = false;
+        continue;
+      }
       switch (event.type) {
         case SDL_QUIT: {
           return;
           break;
           case SDL_WINDOWEVENT: {
-            if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
-              int new_width = event.window.data1;
-              int new_height = event.window.data2;
-              resize(new_width, new_height);
+            switch (event.window.event) {
+              case SDL_WINDOWEVENT_RESIZED: {
+                int new_width = event.window.data1;
+                int new_height = event.window.data2;
+                resize(new_width, new_height);
+                damaged = true;
+                break;
+              }
+              case SDL_WINDOWEVENT_MINIMIZED:
+              case SDL_WINDOWEVENT_HIDDEN:
+                window_visible_ = false;
+                update_visibility();
+                break;
+              case SDL_WINDOWEVENT_SHOWN:
+              case SDL_WINDOWEVENT_RESTORED:
+              case SDL_WINDOWEVENT_MAXIMIZED:
+              case SDL_WINDOWEVENT_EXPOSED:
+                if (!window_visible_) {
+                  window_visible_ = true;
+                  update_visibility();
+                }
+                damaged = true;
+                break;
+              case SDL_WINDOWEVENT_MOVED:
+                // possibly to another display
+                update_frame_interval();
+                break;
             }
             break;
           }
+          case SDL_RENDER_TARGETS_RESET:
+          case SDL_RENDER_DEVICE_RESET: {
+            // the cached rows and frames lost their contents, with the device every texture is lost
+            clear_row_textures();
+            clear_frame_textures();
+            if (event.type == SDL_RENDER_DEVICE_RESET) {
+              font_cache_->reset_textures();
+              background_layer_w_ = background_layer_h_ = 0;
+            }
+            damaged = true;
+            break;
+          }
           case SDL_MOUSEBUTTONDOWN: {
             if (event.button.button == SDL_BUTTON(SDL_BUTTON_LEFT)) {
+              // clicking a pane focuses it
+              auto pane = pane_at(event.button.x, event.button.y);
+              if (!pane) {
+                break;
+              }
+              if (pane != &focused_pane()) {
+                tabs_[active_tab_].focused = pane;
+                damaged = true;
+              }
               has_selection = true;
               mouse_left_button_down = true;
               std::tie(selection_start_row, selection_start_col) = window_to_console(event.button.x, event.button.y);
@@ -385,8 +620,31 @@ void Display::loop() {
                   } else if (c == 'v') {
                     auto s = SDL_GetClipboardText();
                     if (s) {
-                      clipboard_paste(s);
+                      focused_session().clipboard_paste(s);
+                    }
+                  } else if (c == 'h') {
+                    hud_visible_ = !hud_visible_;
+                    hud_lines_.clear();
+                    damaged = true;
+                  } else if (c == 't') {
+                    new_tab();
+                    damaged = true;
+                  } else if (c == 'w') {
+                    close_pane(&focused_pane());
+                    if (tabs_.empty()) {
+                      return;
                     }
+                    damaged = true;
+                  } else if (c == 'e' || c == 'o') {
+                    // e: side by side, o: stacked
+                    split_pane(c == 'e');
+                    damaged = true;
+                  } else if (c == 'n') {
+                    focus_next_pane();
+                    damaged = true;
+                  } else if (c == ']' || c == '[') {
+                    switch_tab((active_tab_ + tabs_.size() + (c == ']' ? 1 : -1)) % tabs_.size());
+                    damaged = true;
                   } else {
                     input_buffer.push_back(c);
                   }
@@ -404,63 +662,137 @@ void Display::loop() {
         }
       }
     }
-    auto t_input1 = std::chrono::high_resolution_clock::now();
+    if (selection != std::make_tuple(has_selection,
+                                     selection_start_row,
+                                     selection_start_col,
+                                     selection_end_row,
+                                     selection_end_col)) {
+      damaged = true;
+    }
 
-    // Communicate with subprocess
-    if (subprocess_->check_exited()) {
+    // Communicate with subprocess, the output is parsed by the reactor workers
+    std::vector<Pane*> exited;
+    for (auto &tab : tabs_) {
+      for_each_pane(*tab.root, [&](Pane &pane) {
+        if (pane.session->exited()) {
+          exited.push_back(&pane);
+        }
+      });
+    }
+    for (auto pane : exited) {
+      close_pane(pane);
+      damaged = true;
+    }
+    if (tabs_.empty()) {
       return;
     }
-    write_pending_input_data(input_buffer);
-    process_input();
+    focused_session().write_pending_input_data(input_buffer);
+    if (has_input) {
+      stats_.record(LatencyStats::STAGE_INPUT, std::chrono::high_resolution_clock::now() - t0);
+    }
 
-    auto t_shell = std::chrono::high_resolution_clock::now();
+    if (next_frame_deadline(damaged) > std::chrono::high_resolution_clock::now()) {
+      continue;
+    }
 
-    // draw console
-    SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 0xff);
-    SDL_RenderClear(renderer_);
+    // pick up the latest screens of the panes on screen
+    visible_panes_.clear();
+    for_each_pane(*tabs_[active_tab_].root, [&](Pane &pane) {
+      pane.frame_snapshot = pane.session->snapshot();
+      pane.rendered_version = pane.frame_snapshot->version;
+      visible_panes_.push_back(&pane);
+    });
+    auto &focused = focused_pane();
+    if (focused.frame_snapshot->window_title != shown_window_title_) {
+      shown_window_title_ = focused.frame_snapshot->window_title;
+      SDL_SetWindowTitle(window_, shown_window_title_.c_str());
+    }
+
+    auto t_render = std::chrono::high_resolution_clock::now();
+    uint64_t draw_calls_before = draw_calls_ + font_cache_->draw_calls();
+    if (hud_visible_) {
+      update_hud(*focused.frame_snapshot);
+    }
 
-    if (background_image_texture) {
-      render_background_image();
+    // draw console
+    update_clear_color(*focused.frame_snapshot);
+    update_background_layer();
+    if (background_texture_) {
+      SDL_RenderCopy(renderer_, background_texture_, nullptr, nullptr);
+      draw_calls_++;
+    } else {
+      SDL_SetRenderDrawColor(renderer_, clear_color_.r, clear_color_.g, clear_color_.b, 0xff);
+      SDL_RenderClear(renderer_);
+      draw_calls_++;
     }
 
-    auto t_bg = std::chrono::high_resolution_clock::now();
 
-    render_chars();
+    // advance the cursor blinking state
+    auto t_blink = std::chrono::high_resolution_clock::now();
+    if (t_blink - cursor_last_time_ >= blink_interval_) {
+      cursor_flip_ = !cursor_flip_;
+      cursor_last_time_ = t_blink;
+    }
+    // new glyphs may complete rows rendered without them
+    font_cache_->next_frame();
 
-    auto t_chars = std::chrono::high_resolution_clock::now();
+    if (software_compositor_) {
+      render_software();
+    } else {
+      render_chars();
+    }
 
-    // Update window
-    SDL_RenderPresent(renderer_);
+    if (latency_bench_) {
+      // the cell the next key is echoed to
+      latency_bench_->on_render(renderer_,
+                                focused.x + glyph_width_ * focused.frame_snapshot->cursor_col,
+                                focused.y + glyph_height_ * focused.frame_snapshot->cursor_row,
+                                glyph_width_,
+                                glyph_height_);
+    }
 
     auto t_present = std::chrono::high_resolution_clock::now();
+    stats_.record(LatencyStats::STAGE_RENDER, t_present - t_render);
+    last_frame_draw_calls_ = draw_calls_ + font_cache_->draw_calls() - draw_calls_before;
 
-    auto now = std::chrono::high_resolution_clock::now();
-    if (has_input) {
-      auto total_latency_ms = std::chrono::duration<float, std::milli>(now - t0).count();
-      constexpr double latency_threshold_ms = 1;
-      if (total_latency_ms > latency_threshold_ms) {
-        std::cerr << "Input latency "
-                  << "  input " << std::chrono::duration<float, std::milli>(t_input1 - t0).count() << "ms" << std::endl
-                  << "  shell " << std::chrono::duration<float, std::milli>(t_shell - t0).count() << "ms" << std::endl
-                  << "  bg " << std::chrono::duration<float, std::milli>(t_bg - t0).count() << "ms" << std::endl
-                  << "  chars " << std::chrono::duration<float, std::milli>(t_chars - t0).count() << "ms" << std::endl
-                  << "  present " << std::chrono::duration<float, std::milli>(t_present- t0).count() << "ms" << std::endl
-                  << "  total " << total_latency_ms << "ms" << std::endl;
+    // Update window
+    SDL_RenderPresent(renderer_);
+    damaged = false;
+
+    last_present_time_ = std::chrono::high_resolution_clock::now();
+    stats_.record(LatencyStats::STAGE_PRESENT, last_present_time_ - t_present);
+    last_frame_time_ = last_present_time_ - t_render;
+    stats_.add_frame();
+
+    if (latency_bench_) {
+      latency_bench_->on_present(last_present_time_);
+      if (latency_bench_->done()) {
+        latency_bench_->report(std::cout);
+        return;
       }
     }
-
-    last_t = now;
   }
 }
+
+void Display::enable_latency_bench(int n_samples) {
+  latency_bench_ = std::make_unique<LatencyBench>(n_samples, std::chrono::milliseconds(50));
+  // a blinking cursor would change the measured cell
+  blink_interval_ = std::chrono::hours(24);
+}
 Display::Display(
     std::ostream &log_stream,
     const std::vector<std::string> &args,
     const std::string &term_env,
     const std::string &font_file_path,
+    const std::vector<std::string> &fallback_font_paths,
     int font_size,
+    size_t glyph_cache_bytes,
     const std::string &background_image_path,
     const std::vector<std::string> &environment_variables,
-    bool use_acceleration) : log_stream_(log_stream) {
+    bool use_acceleration,
+    const std::string &stats_socket_path,
+    const std::string &attach_socket_path,
+    bool verbose_log) : attach_socket_path_(attach_socket_path), verbose_log_(verbose_log), log_stream_(log_stream) {
 
   // We just hard-code an initial resolution.
   // After the window is created, it might be resized.
@@ -475,15 +807,26 @@ Display::Display(
     abort();
   }
 
-  window_ = SDL_CreateWindow(window_title_.c_str(), 0, 0, resolution_w_, resolution_h_, SDL_WINDOW_SHOWN);
+  window_ = SDL_CreateWindow(shown_window_title_.c_str(), 0, 0, resolution_w_, resolution_h_, SDL_WINDOW_SHOWN);
   if (window_ == nullptr) {
     std::cerr << "Error creating window: " << SDL_GetError() << std::endl;
     abort();
   }
 
   SDL_SetWindowResizable(window_, SDL_TRUE);
+  update_frame_interval();
+  redraw_event_type_ = SDL_RegisterEvents(1);
+  if (redraw_event_type_ == (uint32_t) -1) {
+    std::cerr << "Error registering SDL event: " << SDL_GetError() << std::endl;
+    abort();
+  }
 
-  renderer_ = SDL_CreateRenderer(window_, -1, use_acceleration ? SDL_RENDERER_ACCELERATED : SDL_RENDERER_SOFTWARE);
+  // with vsync, present also paces the frames the scheduler decides to draw
+  renderer_ = SDL_CreateRenderer(window_,
+                                 -1,
+                                 SDL_RENDERER_TARGETTEXTURE | (use_acceleration
+                                     ? (SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC)
+                                     : SDL_RENDERER_SOFTWARE));
   if (!renderer_) {
     std::cerr << "Error creating renderer: " << SDL_GetError() << std::endl;
     abort();
@@ -515,31 +858,59 @@ Display::Display(
   glyph_width_ = advance;
   glyph_height_ = TTF_FontLineSkip(font_);
 
-  max_rows_ = resolution_h_ / glyph_height_;
-  max_cols_ = resolution_w_ / glyph_width_;
-
-  font_cache_ = std::make_unique<FontCache>(renderer_, font_);
+  // characters the primary font lacks are looked up in the fallback fonts, in order
+  std::vector<TTF_Font*> fonts{font_};
+  std::vector<std::string> font_paths{font_file_path};
+  for (const auto &path : fallback_font_paths) {
+    if (!std::filesystem::exists(path)) {
+      std::cerr << "Warning fallback font not found '" << path << "'" << std::endl;
+      continue;
+    }
+    auto fallback_font = TTF_OpenFont(path.c_str(), font_size);
+    if (!fallback_font) {
+      std::cerr << "Warning failed to load fallback font '" << path << "': " << TTF_GetError() << std::endl;
+      continue;
+    }
+    fallback_fonts_.push_back(fallback_font);
+    fonts.push_back(fallback_font);
+    font_paths.push_back(path);
+  }
+  // glyphs are rasterized off the render thread
+  int n_rasterizer_workers = std::clamp((int) std::thread::hardware_concurrency() / 2, 1, 4);
+  // the software path composites glyph bitmaps itself, the font cache keeps them instead of an atlas
+  if (!use_acceleration) {
+    software_compositor_ = std::make_unique<SoftwareCompositor>();
+  }
+  font_cache_ = std::make_unique<FontCache>(software_compositor_ ? nullptr : renderer_,
+                                            fonts,
+                                            font_paths,
+                                            font_size,
+                                            glyph_width_,
+                                            glyph_height_,
+                                            glyph_cache_bytes,
+                                            n_rasterizer_workers);
 
   /**
    * Initialize SDL_Image for background image
    */
   IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG);
   if (std::filesystem::exists(background_image_path)) {
-    background_image_texture = IMG_LoadTexture(renderer_, background_image_path.c_str());
-    if (background_image_texture) {
-      int access = 0;
-      Uint32 format;
-      if (SDL_QueryTexture(background_image_texture,
-                           &format,
-                           &access,
-                           &background_image_width,
-                           &background_image_height) == 0) {
-        // ok
-
-      } else {
-        std::cerr << "Failed to query image texture" << SDL_GetError() << std::endl;
+    // decoding a large image takes a while, the first frames are drawn without it
+    background_image_future_ = std::async(std::launch::async, [this, background_image_path]() -> SDL_Surface* {
+      auto surface = IMG_Load(background_image_path.c_str());
+      if (!surface) {
+        std::cerr << "Failed to load background image: " << IMG_GetError() << std::endl;
+        request_redraw();
+        return nullptr;
       }
-    }
+      auto converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+      SDL_FreeSurface(surface);
+      if (!converted) {
+        std::cerr << "Failed to convert background image: " << SDL_GetError() << std::endl;
+      }
+      request_redraw();
+      return converted;
+    });
   } else {
     std::cerr << "Warning background image not found '" << background_image_path << "'" << std::endl;
   }
@@ -548,47 +919,46 @@ Display::Display(
   SDL_SetRenderDrawBlendMode(renderer_, SDL_BLENDMODE_BLEND);
 
   /**
-   * Initialize subprocess
+   * Sessions, every tab starts one running args
    */
-  std::string program = args[0];
-  std::vector<std::string> envs;
+  args_ = args;
   for (const auto &env : environment_variables) {
     if (env.starts_with("TERM=")) {
-      envs.emplace_back("TERM=" + term_env);
+      envs_.emplace_back("TERM=" + term_env);
     } else {
-      envs.emplace_back(env);
+      envs_.emplace_back(env);
     }
   }
-  subprocess_ = std::make_unique<Subprocess>(program, args, envs);
-  set_tty_window_size(subprocess_->tty_fd(), max_cols_, max_rows_, resolution_w_, resolution_h_);
-
-  /**
-   * Initialize multiple screens
-   */
-  default_screen_ = std::make_unique<Screen>(this);
-  alternate_screen_ = std::make_unique<Screen>(this);
-  current_screen_ = default_screen_.get();
+  stats_server_ = std::make_unique<LatencyStatsServer>(stats_, stats_socket_path);
+  // a few workers serve the ptys of all sessions, however many there are
+  reactor_ = std::make_unique<IOReactor>(std::clamp((int) std::thread::hardware_concurrency() / 4, 1, 4));
+  new_tab();
 }
 
-void Display::write_to_tty(std::string_view s) const {
-  int offset = 0;
-  while (offset < s.size()) {
-    int nread = write(subprocess_->tty_fd(), s.data() + offset, s.size() - offset);
-    if (nread < 0) {
-      if (errno != EAGAIN && errno != EWOULDBLOCK) {
-        std::cerr << "Failed to write to tty_fd: " << strerror(errno) << std::endl;
-        break;
-      }
-    } else {
-      offset += nread;
-    }
-  }
-}
 
 Display::~Display() {
+  // textures must go before the renderer
+  clear_row_textures();
+  clear_frame_textures();
+  // the reactor workers push redraw events
+  tabs_.clear();
+  reactor_.reset();
+  font_cache_.reset();
+  if (background_image_future_.valid()) {
+    background_image_surface = background_image_future_.get();
+  }
+  if (background_texture_) {
+    SDL_DestroyTexture(background_texture_);
+  }
+  if (background_image_surface) {
+    SDL_FreeSurface(background_image_surface);
+  }
   if (font_) {
     TTF_CloseFont(font_);
   }
+  for (auto fallback_font : fallback_fonts_) {
+    TTF_CloseFont(fallback_font);
+  }
   if (window_) {
     SDL_DestroyWindow(window_);
   }
@@ -597,24 +967,14 @@ Display::~Display() {
   TTF_Quit();
   SDL_Quit();
 }
-void Display::clipboard_paste(std::string_view clipboard_text) const {
-//  auto clipboard_text = SDL_GetClipboardText();
-  if (current_screen_->current_attrs.test(CHAR_ATTR_XTERM_BLOCK_PASTE)) {
-    write_to_tty("\1b[200~");
-  }
-  // UTF8
-  write_to_tty(clipboard_text);
-  if (current_screen_->current_attrs.test(CHAR_ATTR_XTERM_BLOCK_PASTE)) {
-    write_to_tty("\1b[201~");
-  }
-
-}
 std::string Display::clipboard_copy() {
   if (has_selection) {
+    auto snapshot = focused_session().snapshot();
     std::stringstream ss;
-    for (int i = selection_start_row; i <= selection_end_row; i++) {
-      for (int j = selection_start_col; j <= selection_end_col; j++) {
-        ss << current_screen_->get_row(i)[j].c;
+    for (int i = selection_start_row; i <= selection_end_row && i < snapshot->max_rows; i++) {
+      const auto &row = *snapshot->rows[i];
+      for (int j = selection_start_col; j <= selection_end_col && j < snapshot->max_cols; j++) {
+        ss << row[j].c;
       }
       ss << std::endl;
     }
@@ -631,72 +991,5 @@ void Display::clear_selection() {
   selection_end_col = 0;
   has_selection = false;
 }
-void Display::switch_screen(bool alternate_screen) {
-  alternate_screen_->reset_tty_buffer();
-  if (alternate_screen) {
-    current_screen_ = alternate_screen_.get();
-  } else {
-    current_screen_ = default_screen_.get();
-  }
-}
-void Display::got_character(std::string c) {
-  if (current_screen_->current_attrs.test(CHAR_ATTR_AUTO_WRAP_MODE)) {
-    // https://www.vt100.net/docs/vt510-rm/DECAWM.html
-    // If the DECAWM function is set,
-    // then graphic characters received when the cursor is at the right border of the page
-    //  appear at the beginning of the next line.
-    // Any text on the page scrolls up if the cursor is at the end of the scrolling region.
-    if (current_screen_->cursor_col == max_cols_) {
-      current_screen_->new_line();
-      current_screen_->carriage_return();
-    }
-    current_screen_->fill_current_cursor(std::move(c));
-    current_screen_->cursor_col++;
-  } else {
-    // If the DECAWM function is reset,
-    // then graphic characters received when the cursor is at the right border of the page
-    //  replace characters already on the page.
-    current_screen_->fill_current_cursor(std::move(c));
-    if (current_screen_->cursor_col < max_cols_ - 1) {
-      current_screen_->cursor_col++;
-    }
-  }
-
-}
-void Display::log_verbose_input_char(uint32_t c, bool has_color) {
-  if (std::isprint(c)) {
-    log_stream_.put(c);
-    log_stream_.flush();
-  } else {
-    if (c == '\n') {
-      log_stream_.put(c);
-    } else {
-      if (has_color) {
-        log_stream_ << "\x1b[33m{\x1b[32m";
-      } else {
-        log_stream_ << "{";
-      }
-
-      if (c < sizeof(escape_table)/sizeof(escape_table[0]) && escape_table[c]) {
-        log_stream_ << escape_table[c];
-      } else {
-        log_stream_ << "\\x" << std::setw(2) << std::setfill('0') << std::hex << c;
-      }
-      if (has_color) {
-        log_stream_ << "\x1b[33m}\x1b[0m";
-      } else {
-        log_stream_ << "}";
-      }
-      log_stream_.flush();
-    }
-  }
-  std::cout << "char at (" << std::dec << current_screen_->cursor_row << "," << current_screen_->cursor_col << "): 0x" <<
-            std::setw(2) << std::setfill('0') << std::hex << (int)(uint8_t)c;
-  if (std::isprint(c) && c != '\n') {
-    std::cout << " '" << c << '\'';
-  }
-  std::cout << std::endl;
-
-}
 
 }
\ No newline at end of file
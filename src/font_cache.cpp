@@ -2,15 +2,22 @@
 
 #include <cassert>
 
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
 
+#include <sys/ioctl.h>
+
 #include <SDL2/SDL_rect.h>
 #include <SDL2/SDL_ttf.h>
 
 #include <te/screen.hpp>
 #include <te/display.hpp>
+#include <te/software_compositor.hpp>
+#include <te/unicode.hpp>
 
 namespace std {
   template <>
@@ -30,141 +37,1193 @@ namespace std {
 
 namespace te {
 
-std::vector<std::string> extra_chars = {
-    "␣", "─",
-};
+// length of the utf8 sequence starting with byte b, 1 for invalid bytes
+static int utf8_length(uint8_t b) {
+  if ((b & 0xe0u) == 0xc0u) {
+    return 2;
+  } else if ((b & 0xf0u) == 0xe0u) {
+    return 3;
+  } else if ((b & 0xf8u) == 0xf0u) {
+    return 4;
+  }
+  return 1;
+}
 
-FontCache::FontCache(SDL_Renderer *renderer, TTF_Font *font) :renderer_(renderer), font_(font) {
+FontCache::FontCache(SDL_Renderer *renderer,
+                     std::vector<TTF_Font*> fonts,
+                     const std::vector<std::string> &font_paths,
+                     int font_size,
+                     int glyph_width,
+                     int glyph_height,
+                     size_t memory_budget_bytes,
+                     int n_rasterizer_workers)
+    :renderer_(renderer), fonts_(std::move(fonts)), coverage_(fonts_.size()), glyph_width_(glyph_width) {
+  assert(!fonts_.empty());
+  assert(fonts_.size() == font_paths.size());
+  // leave room for wide and italic glyphs
+  slot_width_ = glyph_width * 2;
+  slot_height_ = glyph_height;
+  page_width_ = std::max(page_width_, slot_width_);
+  page_height_ = std::max(page_height_, slot_height_);
+  slots_per_row_ = page_width_ / slot_width_;
+  slots_per_page_ = slots_per_row_ * (page_height_ / slot_height_);
+  max_pages_ = std::max<size_t>(1, memory_budget_bytes / ((size_t) page_width_ * page_height_ * 4));
 
-  std::vector<uint32_t> styles = {
-      TTF_STYLE_NORMAL,
+  // SDL_ttf renders at 72 DPI
+  constexpr int font_dpi = 72;
+  disk_cache_ = std::make_unique<GlyphDiskCache>(GlyphDiskCache::default_path(font_paths, font_size, font_dpi));
+  rasterizer_ = std::make_unique<GlyphRasterizer>(font_paths,
+                                                  font_size,
+                                                  slot_width_,
+                                                  slot_height_,
+                                                  n_rasterizer_workers,
+                                                  disk_cache_->ok() ? disk_cache_.get() : nullptr);
+  // nothing is prerendered, the glyph for missing characters is requested right away
+  get(TTF_STYLE_NORMAL, "?");
+}
 
-      TTF_STYLE_UNDERLINE,
-      TTF_STYLE_BOLD,
-      TTF_STYLE_ITALIC,
+FontCache::~FontCache() {
+  rasterizer_.reset();
+  for (auto page : pages_) {
+    SDL_DestroyTexture(page);
+  }
+}
 
-      TTF_STYLE_UNDERLINE | TTF_STYLE_BOLD,
-      TTF_STYLE_UNDERLINE | TTF_STYLE_ITALIC,
-      TTF_STYLE_BOLD | TTF_STYLE_ITALIC,
+const FontCache::Glyph *FontCache::get(uint32_t style, const std::string &c) {
+  auto entry = find(style, c);
+  return entry ? &entry->glyph : nullptr;
+}
 
-      TTF_STYLE_UNDERLINE | TTF_STYLE_BOLD | TTF_STYLE_ITALIC,
-  };
+const GlyphRasterizer::Bitmap *FontCache::get_bitmap(uint32_t style, const std::string &c) {
+  auto entry = find(style, c);
+  return entry ? &entry->bitmap : nullptr;
+}
 
-  SDL_Color white_color{0xff,0xff,0xff,0xff};
-  for (auto style : styles) {
-    auto [it, ok] = fc.insert({style, {}});
-    assert(ok);
-
-    TTF_SetFontStyle(font_, style);
-    for (int i = 0; i < 128; i++) {
-      if (std::isprint(i)) {
-        SDL_Surface *text_surf = TTF_RenderGlyph_Blended(font_, i, white_color);
-        if (!text_surf) {
-          std::cerr << "Failed to TTF_RenderGlyph_Blended" << SDL_GetError() << std::endl;
-          abort();
-        }
+FontCache::Entry *FontCache::find(uint32_t style, const std::string &c) {
+  // style fits in one byte, the key stays in the small string buffer for all but long graphemes
+  std::string key;
+  key.reserve(c.size() + 1);
+  key.push_back((char) style);
+  key += c;
 
-        auto texture = SDL_CreateTextureFromSurface(renderer_, text_surf);
-        if (!texture) {
-          std::cerr << "Failed to SDL_CreateTextureFromSurface when creating fonts:" << SDL_GetError() << std::endl;
-          abort();
-        }
+  auto it = fc.find(key);
+  if (it != fc.end()) {
+    hits_++;
+    return touch(it->second);
+  }
+
+  misses_++;
+  if (pending_.find(key) != pending_.end()) {
+    return nullptr;
+  }
+
+  if (missing_.find(key) == missing_.end()) {
+    int font = font_for(utf8_decode(c));
+    if (font >= 0) {
+      // the workers look in the disk cache first
+      pending_.insert(key);
+      rasterizer_->submit(GlyphRasterizer::Job{std::move(key), style, c, font});
+      return nullptr;
+    }
+    missing_.insert(key);
+  }
+
+  if (c != "?") {
+    return find(style, "?");
+  } else if (style != TTF_STYLE_NORMAL) {
+    return find(TTF_STYLE_NORMAL, "?");
+  } else {
+    return nullptr;
+  }
+}
 
-        it->second[std::string(1, i)] = texture;
+FontCache::Entry *FontCache::touch(Entry &entry) {
+  if (entry.last_used_frame != frame_) {
+    // move to front once per frame
+    lru_.splice(lru_.begin(), lru_, entry.lru);
+    entry.last_used_frame = frame_;
+  }
+  return &entry;
+}
+
+FontCache::RunStatus FontCache::get_run(uint32_t style,
+                                        const std::string &text,
+                                        int cells,
+                                        std::vector<const Glyph*> &glyphs) {
+  auto status = find_run(style, text, cells);
+  if (status == RunStatus::READY) {
+    glyphs.clear();
+    for (auto entry : run_entries_) {
+      glyphs.push_back(&entry->glyph);
+    }
+  }
+  return status;
+}
+
+FontCache::RunStatus FontCache::get_run_bitmaps(uint32_t style,
+                                                const std::string &text,
+                                                int cells,
+                                                std::vector<const GlyphRasterizer::Bitmap*> &bitmaps) {
+  auto status = find_run(style, text, cells);
+  if (status == RunStatus::READY) {
+    bitmaps.clear();
+    for (auto entry : run_entries_) {
+      bitmaps.push_back(&entry->bitmap);
+    }
+  }
+  return status;
+}
+
+// the slices of a run are looked up one by one, any slice may have been evicted
+FontCache::RunStatus FontCache::find_run(uint32_t style, const std::string &text, int cells) {
+  if (cells <= 0 || cells > max_run_cells) {
+    return RunStatus::UNAVAILABLE;
+  }
+  std::string key;
+  key.reserve(text.size() + 4);
+  key.push_back((char) (style | run_key_flag));
+  key.push_back((char) cells);
+  key += text;
+
+  run_entries_.clear();
+  std::string slice_key = key;
+  slice_key.push_back('\0');
+  slice_key.push_back(0);
+  for (int i = 0; i < cells; i++) {
+    slice_key.back() = (char) i;
+    auto it = fc.find(slice_key);
+    if (it == fc.end()) {
+      break;
+    }
+    run_entries_.push_back(&it->second);
+  }
+  if (run_entries_.size() == cells) {
+    hits_++;
+    for (auto entry : run_entries_) {
+      touch(*entry);
+    }
+    return RunStatus::READY;
+  }
+  run_entries_.clear();
+
+  misses_++;
+  if (pending_.find(key) != pending_.end()) {
+    return RunStatus::PENDING;
+  }
+  if (missing_.find(key) != missing_.end()) {
+    return RunStatus::UNAVAILABLE;
+  }
+  // shaping happens within one font, mixed fallback fonts are drawn cell by cell
+  int font = -1;
+  for (size_t i = 0; i < text.size();) {
+    int n = utf8_length(text[i]);
+    int cell_font = font_for(utf8_decode(text.substr(i, n)));
+    if (cell_font < 0 || (font >= 0 && cell_font != font)) {
+      missing_.insert(std::move(key));
+      return RunStatus::UNAVAILABLE;
+    }
+    font = cell_font;
+    i += n;
+  }
+  pending_.insert(key);
+  rasterizer_->submit(GlyphRasterizer::Job{std::move(key), style, text, font, glyph_width_ * cells});
+  return RunStatus::PENDING;
+}
+
+bool FontCache::insert(const std::string &key, GlyphRasterizer::Bitmap &&bitmap) {
+  Glyph glyph{};
+  if (!allocate_slot(glyph)) {
+    return false;
+  }
+  glyph.w = bitmap.w;
+  glyph.h = bitmap.h;
+  if (renderer_) {
+    stage(glyph, bitmap);
+  }
+  // key may be bitmap.key, which is moved from below
+  lru_.push_front(key);
+  Entry entry{glyph, lru_.begin(), frame_};
+  if (!renderer_) {
+    entry.bitmap = std::move(bitmap);
+    entry.bitmap.key.clear();
+  }
+  fc.emplace(lru_.front(), std::move(entry));
+  return true;
+}
+
+bool FontCache::next_frame() {
+  frame_++;
+  rasterizer_->collect(ready_);
+  size_t n = std::min(ready_.size(), max_uploads_per_frame_);
+  for (size_t i = 0; i < n; i++) {
+    auto &bitmap = ready_[i];
+    pending_.erase(bitmap.key);
+    if (!bitmap.ok) {
+      std::cerr << "Failed to rasterize glyph: " << bitmap.error << std::endl;
+      missing_.insert(bitmap.key);
+      continue;
+    }
+    if (!((uint8_t) bitmap.key[0] & run_key_flag)) {
+      if (!insert(bitmap.key, std::move(bitmap))) {
+        std::cerr << "Failed to add glyph to atlas: " << SDL_GetError() << std::endl;
+        missing_.insert(bitmap.key);
       }
+      continue;
     }
-    for (const auto &extra_char : extra_chars) {
-      SDL_Surface *text_surf = TTF_RenderUTF8_Blended(font_, extra_char.c_str(), white_color);
-      if (!text_surf) {
-        std::cerr << "Failed to TTF_RenderGlyph_Blended" << SDL_GetError() << std::endl;
-        abort();
+
+    // a shaped run, one glyph_width_ wide slice per cell
+    int cells = bitmap.key[1];
+    std::string slice_key = bitmap.key;
+    slice_key.push_back('\0');
+    slice_key.push_back(0);
+    for (int cell = 0; cell < cells; cell++) {
+      slice_key.back() = (char) cell;
+      if (fc.find(slice_key) != fc.end()) {
+        // the slices that were not evicted
+        continue;
       }
+      GlyphRasterizer::Bitmap slice;
+      slice.ok = true;
+      int x0 = std::min(bitmap.w, cell * glyph_width_);
+      slice.w = std::min(bitmap.w - x0, glyph_width_);
+      slice.h = bitmap.h;
+      slice.alpha.resize(slice.w * slice.h);
+      for (int y = 0; y < slice.h; y++) {
+        std::copy_n(bitmap.alpha.data() + y * bitmap.w + x0, slice.w, slice.alpha.data() + y * slice.w);
+      }
+      if (!insert(slice_key, std::move(slice))) {
+        std::cerr << "Failed to add shaped run to atlas: " << SDL_GetError() << std::endl;
+        break;
+      }
+    }
+  }
+  ready_.erase(ready_.begin(), ready_.begin() + n);
+  if (renderer_ && !upload_pages()) {
+    std::cerr << "Failed to upload glyph atlas: " << SDL_GetError() << std::endl;
+  }
+  return n > 0;
+}
 
-      auto text = SDL_CreateTextureFromSurface(renderer_, text_surf);
-      if (!text) {
-        std::cerr << "Failed to SDL_CreateTextureFromSurface when creating fonts:" << SDL_GetError() << std::endl;
-        abort();
+// index of the first font providing codepoint, -1 if none
+int FontCache::font_for(uint32_t codepoint) {
+  uint32_t block = codepoint >> 8u;
+  for (size_t i = 0; i < fonts_.size(); i++) {
+    auto &blocks = coverage_[i];
+    auto it = blocks.find(block);
+    if (it == blocks.end()) {
+      std::bitset<256> coverage;
+      for (uint32_t j = 0; j < 256; j++) {
+        coverage.set(j, TTF_GlyphIsProvided32(fonts_[i], (block << 8u) | j));
+      }
+      it = blocks.emplace(block, coverage).first;
+    }
+    if (it->second.test(codepoint & 0xffu)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// take a free atlas slot, or the slot of the least recently used glyph when the budget is used up
+bool FontCache::allocate_slot(Glyph &glyph) {
+  int slot;
+  if (next_slot_ < max_pages_ * slots_per_page_) {
+    slot = next_slot_++;
+    int page = slot / slots_per_page_;
+    if (renderer_ && page == pages_.size()) {
+      auto texture = create_page();
+      if (!texture) {
+        return false;
       }
+      pages_.push_back(texture);
+      page_alpha_.emplace_back((size_t) page_width_ * page_height_, 0);
+      page_dirty_.emplace_back();
+      vertices_.emplace_back();
+      indices_.emplace_back();
+    }
+    glyph.page = page;
+    glyph.x = (slot % slots_per_page_ % slots_per_row_) * slot_width_;
+    glyph.y = (slot % slots_per_page_ / slots_per_row_) * slot_height_;
+    return true;
+  }
+
+  if (lru_.empty()) {
+    return false;
+  }
+  auto victim = fc.find(lru_.back());
+  assert(victim != fc.end());
+  if (victim->second.last_used_frame == frame_) {
+    // every glyph is in use in this frame, draw what is queued before overwriting the slot
+    flush();
+  }
+  glyph.page = victim->second.glyph.page;
+  glyph.x = victim->second.glyph.x;
+  glyph.y = victim->second.glyph.y;
+  lru_.pop_back();
+  fc.erase(victim);
+  return true;
+}
+
+SDL_Texture *FontCache::create_page() {
+  auto texture = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, page_width_, page_height_);
+  if (texture) {
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+  }
+  return texture;
+}
+
+void FontCache::reset_textures() {
+  for (size_t page = 0; page < pages_.size(); page++) {
+    SDL_DestroyTexture(pages_[page]);
+    pages_[page] = create_page();
+    if (!pages_[page]) {
+      std::cerr << "Failed to recreate glyph atlas page: " << SDL_GetError() << std::endl;
+      abort();
+    }
+    // the alpha copy has every slot
+    page_dirty_[page] = DirtyRect{0, 0, page_width_, page_height_};
+  }
+}
+
+void FontCache::stage(const Glyph &glyph, const GlyphRasterizer::Bitmap &bitmap) {
+  // the whole slot is written since the previous glyph might have been larger
+  auto &alpha = page_alpha_[glyph.page];
+  for (int y = 0; y < slot_height_; y++) {
+    auto line = alpha.data() + (size_t) (glyph.y + y) * page_width_ + glyph.x;
+    std::fill_n(line, slot_width_, 0);
+    if (y < bitmap.h) {
+      std::copy_n(bitmap.alpha.data() + y * bitmap.w, bitmap.w, line);
+    }
+  }
+  auto &dirty = page_dirty_[glyph.page];
+  if (dirty.x0 == dirty.x1) {
+    dirty = DirtyRect{glyph.x, glyph.y, glyph.x + slot_width_, glyph.y + slot_height_};
+  } else {
+    dirty.x0 = std::min(dirty.x0, glyph.x);
+    dirty.y0 = std::min(dirty.y0, glyph.y);
+    dirty.x1 = std::max(dirty.x1, glyph.x + slot_width_);
+    dirty.y1 = std::max(dirty.y1, glyph.y + slot_height_);
+  }
+}
 
-      it->second[extra_char] = text;
+bool FontCache::upload_pages() {
+  bool ok = true;
+  for (size_t page = 0; page < pages_.size(); page++) {
+    auto &dirty = page_dirty_[page];
+    if (dirty.x0 == dirty.x1) {
+      continue;
+    }
+    // white glyphs with the coverage as alpha
+    int w = dirty.x1 - dirty.x0, h = dirty.y1 - dirty.y0;
+    upload_pixels_.resize((size_t) w * h);
+    auto &alpha = page_alpha_[page];
+    for (int y = 0; y < h; y++) {
+      auto line = alpha.data() + (size_t) (dirty.y0 + y) * page_width_ + dirty.x0;
+      for (int x = 0; x < w; x++) {
+        upload_pixels_[y * w + x] = ((uint32_t) line[x] << 24u) | 0xffffffu;
+      }
     }
+    SDL_Rect rect{dirty.x0, dirty.y0, w, h};
+    ok = SDL_UpdateTexture(pages_[page], &rect, upload_pixels_.data(), w * 4) == 0 && ok;
+    dirty = DirtyRect{};
+  }
+  return ok;
+}
 
+void FontCache::draw(const Glyph &glyph, int x, int y, int w, int h, Color color) {
+  auto &vertices = vertices_[glyph.page];
+  auto &indices = indices_[glyph.page];
+  float u0 = (float) glyph.x / page_width_, v0 = (float) glyph.y / page_height_;
+  float u1 = (float) (glyph.x + glyph.w) / page_width_, v1 = (float) (glyph.y + glyph.h) / page_height_;
+  SDL_Color sdl_color{color.r, color.g, color.b, 0xff};
+
+  int base = vertices.size();
+  vertices.push_back(SDL_Vertex{{(float) x, (float) y}, sdl_color, {u0, v0}});
+  vertices.push_back(SDL_Vertex{{(float) (x + w), (float) y}, sdl_color, {u1, v0}});
+  vertices.push_back(SDL_Vertex{{(float) (x + w), (float) (y + h)}, sdl_color, {u1, v1}});
+  vertices.push_back(SDL_Vertex{{(float) x, (float) (y + h)}, sdl_color, {u0, v1}});
+  for (int i : {0, 1, 2, 0, 2, 3}) {
+    indices.push_back(base + i);
   }
 }
 
+void FontCache::flush() {
+  for (size_t page = 0; page < pages_.size(); page++) {
+    auto &vertices = vertices_[page];
+    auto &indices = indices_[page];
+    if (!vertices.empty()) {
+      SDL_RenderGeometry(renderer_, pages_[page], vertices.data(), vertices.size(), indices.data(), indices.size());
+      draw_calls_++;
+      vertices.clear();
+      indices.clear();
+    }
+  }
+}
 
 static SDL_Color to_sdl_color(Color color) {
   return SDL_Color{color.r, color.g, color.b, color.a};
 }
 
+// TTF style of a cell
+static uint32_t char_style(const Char &c) {
+  uint32_t style = TTF_STYLE_NORMAL;
+  if (c.attr.test(CHAR_ATTR_UNDERLINE)) {
+    style |= TTF_STYLE_UNDERLINE;
+  }
+  if (c.attr.test(CHAR_ATTR_BOLD)) {
+    style |= TTF_STYLE_BOLD;
+  }
+  if (c.attr.test(CHAR_ATTR_ITALIC)) {
+    style |= TTF_STYLE_ITALIC;
+  }
+  return style;
+}
+
+static bool char_is_blank(const Char &c) {
+  return c.c.empty() || (c.c.size() == 1 && c.c[0] == 0 || c.c[0] == ' ');
+}
+
+// cells the glyph of a cell is drawn over
+static int char_columns(const Char &c) {
+  return c.attr.test(CHAR_ATTR_WIDE) ? 2 : 1;
+}
+
+// punctuation programming fonts join into ligatures, e.g. -> != <= ::
+static bool is_ligature_candidate(const Char &c) {
+  if (c.c.size() != 1) {
+    return false;
+  }
+  switch (c.c[0]) {
+    case '!': case '#': case '$': case '%': case '&': case '*': case '+': case '-': case '.': case '/': case ':':
+    case ';': case '<': case '=': case '>': case '?': case '@': case '\\': case '^': case '_': case '|': case '~':
+      return true;
+    default:
+      return false;
+  }
+}
+
+// code points that only render right when shaped together with their neighbours:
+//  combining marks, and scripts with contextual forms (Hebrew to Myanmar, Khmer, Arabic presentation forms)
+static bool needs_shaping(uint32_t cp) {
+  return (0x0300 <= cp && cp < 0x0370)
+      || (0x0590 <= cp && cp < 0x10a0)
+      || (0x1780 <= cp && cp < 0x1800)
+      || (0x1ab0 <= cp && cp < 0x1b00)
+      || (0x1dc0 <= cp && cp < 0x1e00)
+      || (0x20d0 <= cp && cp < 0x2100)
+      || (0xfb1d <= cp && cp < 0xfe00)
+      || (0xfe20 <= cp && cp < 0xfe30)
+      || (0xfe70 <= cp && cp < 0xff00);
+}
+
+static std::string run_text(const Row &row_data, int start, int end) {
+  std::string text;
+  for (int col = start; col < end; col++) {
+    text += row_data[col].c;
+  }
+  return text;
+}
+
+// Screen rows are rendered into cached row textures, only rows with a new version are rendered again.
+// Row versions are unique across sessions, so the panes share the row textures and the glyph atlas, and a pane
+//  costs its frame textures on top of the rows it shows.
 void Display::render_chars() {
-  for (int row = 0; row < max_rows_; row++) {
-    auto &row_data = current_screen_->get_row(row);
-    for (int col = 0; col < max_cols_; col++) {
-      auto &c = row_data[col];
-      SDL_Rect glyph_box{glyph_width_ * col, glyph_height_ * row, glyph_width_, glyph_height_};
-      Color fg = c.fg_color, bg = c.bg_color;
-
-      // draw cursor background
-      if (row == current_screen_->cursor_row && col == current_screen_->cursor_col && current_screen_->cursor_show) {
-        if (current_screen_->cursor_blink) {
-          if (current_screen_->cursor_flip) {
-            bg = current_screen_->cursor_color;
-            fg = current_screen_->cursor_fg_color;
-          }
-          auto now = std::chrono::high_resolution_clock::now();
-          if (now - current_screen_->cursor_last_time > current_screen_->blink_interval) {
-            current_screen_->cursor_flip = !current_screen_->cursor_flip;
-            current_screen_->cursor_last_time = now;
-          }
-        } else {
-          bg = current_screen_->cursor_color;
-          fg = current_screen_->cursor_fg_color;
+  // rows of the last frame not on screen any more give their texture to new rows
+  next_row_textures_.clear();
+  for (auto pane : visible_panes_) {
+    const auto &snapshot = *pane->frame_snapshot;
+    int max_rows = std::min(pane->rows, snapshot.max_rows);
+    for (int row = 0; row < max_rows; row++) {
+      const auto &row_data = *snapshot.rows[row];
+      RowTexture row_texture{};
+      auto it = row_textures_.find(row_data.version());
+      if (it != row_textures_.end()) {
+        row_texture = it->second;
+        row_textures_.erase(it);
+      }
+      next_row_textures_.emplace(row_data.version(), row_texture);
+    }
+  }
+  for (auto &[version, row_texture] : row_textures_) {
+    if (row_texture.texture) {
+      free_row_textures_.push_back(row_texture);
+    }
+  }
+  row_textures_.clear();
+  std::swap(row_textures_, next_row_textures_);
+  // free textures of a width no pane has any more
+  std::erase_if(free_row_textures_, [&](const RowTexture &row_texture) {
+    bool used = std::any_of(visible_panes_.begin(), visible_panes_.end(), [&](const Pane *pane) {
+      return std::min(pane->cols, pane->frame_snapshot->max_cols) == row_texture.cols;
+    });
+    if (!used) {
+      SDL_DestroyTexture(row_texture.texture);
+    }
+    return !used;
+  });
+
+  for (auto pane : visible_panes_) {
+    render_pane(*pane);
+  }
+  render_layout();
+  layout_damaged_ = false;
+}
+
+// The rows of a pane are composed into a frame texture kept between frames. When the screen scrolled, the previous
+//  frame is copied shifted and only the newly exposed rows are drawn.
+// Cursor and selection are drawn over the frame, so they never invalidate a row.
+void Display::render_pane(Pane &pane) {
+  const auto &snapshot = *pane.frame_snapshot;
+  update_color_lut(pane);
+  int max_rows = std::min(pane.rows, snapshot.max_rows), max_cols = std::min(pane.cols, snapshot.max_cols);
+  if (max_cols != pane.frame_cols) {
+    pane.frame_cols = max_cols;
+    pane.frame_row_versions.clear();
+  }
+
+  /**
+   * Frame texture
+   */
+  int frame_w = glyph_width_ * max_cols, frame_h = glyph_height_ * max_rows;
+  if (frame_w != pane.frame_texture_w || frame_h != pane.frame_texture_h) {
+    clear_frame_textures(pane);
+    for (auto &texture : pane.frame_textures) {
+      texture = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, frame_w, frame_h);
+      if (!texture) {
+        std::cerr << "Failed to create frame texture: " << SDL_GetError() << std::endl;
+        abort();
+      }
+      // the frame is opaque, copy it as is
+      SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE);
+    }
+    pane.frame_texture_w = frame_w;
+    pane.frame_texture_h = frame_h;
+  }
+  if (pane.frame_row_versions.size() != max_rows || snapshot.alternate_screen != pane.frame_alternate_screen) {
+    pane.frame_row_versions.assign(max_rows, 0);
+  }
+
+  // pure scroll: copy the previous frame shifted by delta rows into the other frame texture
+  int64_t delta = snapshot.scroll_offset - pane.frame_scroll_offset;
+  if (delta != 0) {
+    if (std::abs(delta) < max_rows) {
+      int shift = delta;
+      SDL_Rect src{0, 0, frame_w, glyph_height_ * (max_rows - std::abs(shift))};
+      SDL_Rect dst = src;
+      if (shift > 0) {
+        src.y = glyph_height_ * shift;
+      } else {
+        dst.y = glyph_height_ * -shift;
+      }
+      SDL_SetRenderTarget(renderer_, pane.frame_textures[1 - pane.frame_index]);
+      SDL_RenderCopy(renderer_, pane.frame_textures[pane.frame_index], &src, &dst);
+      draw_calls_++;
+      pane.frame_index = 1 - pane.frame_index;
+      scroll_frame_row_versions(pane, shift);
+    } else {
+      std::fill(pane.frame_row_versions.begin(), pane.frame_row_versions.end(), 0);
+    }
+  }
+  pane.frame_scroll_offset = snapshot.scroll_offset;
+  pane.frame_alternate_screen = snapshot.alternate_screen;
+
+  // draw the rows that changed into the frame
+  auto frame_texture = pane.frame_textures[pane.frame_index];
+  for (int row = 0; row < max_rows; row++) {
+    const auto &row_data = *snapshot.rows[row];
+    if (pane.frame_row_versions[row] == row_data.version()) {
+      continue;
+    }
+    auto &row_texture = row_textures_.at(row_data.version());
+    if (!row_texture.texture) {
+      auto it = std::find_if(free_row_textures_.rbegin(), free_row_textures_.rend(), [&](const RowTexture &free) {
+        return free.cols == max_cols;
+      });
+      if (it == free_row_textures_.rend()) {
+        row_texture.texture = SDL_CreateTexture(renderer_,
+                                                SDL_PIXELFORMAT_ARGB8888,
+                                                SDL_TEXTUREACCESS_TARGET,
+                                                glyph_width_ * max_cols,
+                                                glyph_height_);
+        if (!row_texture.texture) {
+          std::cerr << "Failed to create row texture: " << SDL_GetError() << std::endl;
+          abort();
         }
-      } else if (has_selection) {
-        auto start = std::make_tuple(selection_start_row, selection_start_col),
-            end = std::make_tuple(selection_end_row, selection_end_col);
-        if (in_range(start, end, std::make_tuple(row, col))) {
-          bg = selection_bg_color;
-          fg = selection_fg_color;
+        // premultiplied by render_row(), blending them again as straight alpha would darken glyph edges
+        SDL_SetTextureBlendMode(row_texture.texture,
+                                SDL_ComposeCustomBlendMode(SDL_BLENDFACTOR_ONE,
+                                                           SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+                                                           SDL_BLENDOPERATION_ADD,
+                                                           SDL_BLENDFACTOR_ONE,
+                                                           SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+                                                           SDL_BLENDOPERATION_ADD));
+      } else {
+        row_texture.texture = it->texture;
+        free_row_textures_.erase(std::next(it).base());
+      }
+      row_texture.cols = max_cols;
+      row_texture.complete = false;
+    }
+    if (!row_texture.complete) {
+      SDL_SetRenderTarget(renderer_, row_texture.texture);
+      row_texture.complete = render_row(row_data, max_cols);
+    }
+
+    SDL_SetRenderTarget(renderer_, frame_texture);
+    SDL_Rect dst{0, glyph_height_ * row, frame_w, glyph_height_};
+    // the window background behind the row, the same slice of the background layer
+    if (background_texture_) {
+      SDL_Rect src{pane.x, pane.y + dst.y, dst.w, dst.h};
+      SDL_RenderCopy(renderer_, background_texture_, &src, &dst);
+      draw_calls_++;
+    } else {
+      SDL_SetRenderDrawBlendMode(renderer_, SDL_BLENDMODE_NONE);
+      SDL_SetRenderDrawColor(renderer_, clear_color_.r, clear_color_.g, clear_color_.b, 0xff);
+      SDL_RenderFillRect(renderer_, &dst);
+      draw_calls_++;
+      SDL_SetRenderDrawBlendMode(renderer_, SDL_BLENDMODE_BLEND);
+    }
+    SDL_RenderCopy(renderer_, row_texture.texture, nullptr, &dst);
+    draw_calls_++;
+    // an incomplete row is drawn again once its glyphs are ready
+    pane.frame_row_versions[row] = row_texture.complete ? row_data.version() : 0;
+  }
+  SDL_SetRenderTarget(renderer_, nullptr);
+
+  SDL_Rect frame_rect{pane.x, pane.y, frame_w, frame_h};
+  SDL_RenderCopy(renderer_, frame_texture, nullptr, &frame_rect);
+  draw_calls_++;
+
+  render_overlay(pane, max_rows, max_cols);
+  if (&pane == &focused_pane()) {
+    render_hud(pane, max_rows, max_cols);
+  }
+}
+
+// Render one row at the top of the current render target, without cursor and selection.
+// The row is premultiplied: backgrounds are filled with premultiplied colors, and glyphs blended over them with
+//  straight alpha give premultiplied results.
+// Returns false if some glyphs are not rasterized yet.
+bool Display::render_row(const Row &row_data, int max_cols) {
+  // transparent where the frame's clear color or the background image shows through
+  SDL_SetRenderDrawBlendMode(renderer_, SDL_BLENDMODE_NONE);
+  SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 0);
+  SDL_RenderClear(renderer_);
+  draw_calls_++;
+
+  /**
+   * Backgrounds: merge cells of the same color into runs.
+   * Runs of the clear color are skipped when there is no background image to dim.
+   */
+  collect_bg_runs(row_data, max_cols, background_layer_.empty());
+  // one SDL_RenderFillRects per color
+  std::stable_sort(row_bg_rects_.begin(), row_bg_rects_.end(), [](const auto &lhs, const auto &rhs) {
+    return std::get<0>(lhs).u32 < std::get<0>(rhs).u32;
+  });
+  std::vector<SDL_Rect> rects;
+  for (size_t i = 0; i < row_bg_rects_.size();) {
+    Color color = std::get<0>(row_bg_rects_[i]);
+    rects.clear();
+    for (; i < row_bg_rects_.size() && std::get<0>(row_bg_rects_[i]).u32 == color.u32; i++) {
+      rects.push_back(SDL_Rect{std::get<1>(row_bg_rects_[i]), 0, std::get<2>(row_bg_rects_[i]), glyph_height_});
+    }
+    int a = background_image_opaque;
+    SDL_SetRenderDrawColor(renderer_, color.r * a / 255, color.g * a / 255, color.b * a / 255, a);
+    SDL_RenderFillRects(renderer_, rects.data(), rects.size());
+    draw_calls_++;
+  }
+  SDL_SetRenderDrawBlendMode(renderer_, SDL_BLENDMODE_BLEND);
+
+  /**
+   * Glyphs, erased cells have none
+   */
+  bool complete = true;
+  int glyph_cols = std::min(max_cols, row_data.blank_from());
+  collect_shaped_runs(row_data, glyph_cols);
+  std::vector<const FontCache::Glyph*> run_glyphs;
+  size_t next_run = 0;
+  for (int col = 0; col < glyph_cols; col++) {
+    if (next_run < row_shaped_runs_.size() && std::get<0>(row_shaped_runs_[next_run]) == col) {
+      auto [start, end] = row_shaped_runs_[next_run++];
+      auto status = font_cache_->get_run(char_style(row_data[col]), run_text(row_data, start, end), end - start, run_glyphs);
+      if (status == FontCache::RunStatus::READY) {
+        for (int i = start; i < end; i++) {
+          auto glyph = run_glyphs[i - start];
+          if (glyph->w > 0) {
+            font_cache_->draw(*glyph, glyph_width_ * i, 0, glyph->w, glyph->h, cell_fg(row_data[i]));
+          }
         }
+        col = end - 1;
+        continue;
       }
+      // drawn cell by cell until the run is shaped
+      complete = complete && status != FontCache::RunStatus::PENDING;
+    }
+    auto &c = row_data[col];
+    if (char_is_blank(c)) {
+      continue;
+    }
+    auto glyph = font_cache_->get(char_style(c), c.c);
+    if (!glyph) {
+      // still being rasterized, render the row again later
+      complete = false;
+      continue;
+    }
+    font_cache_->draw(*glyph, glyph_width_ * col, 0, glyph_width_ * char_columns(c), glyph_height_, cell_fg(c));
+  }
+  // all glyphs of the row in one batch per atlas page
+  font_cache_->flush();
+  return complete;
+}
 
-      fg = map_color(fg);
-      bg = map_color(bg);
+// shift the versions of the frame rows up by shift rows (down if negative), exposed rows are drawn again
+void Display::scroll_frame_row_versions(Pane &pane, int shift) {
+  auto &versions = pane.frame_row_versions;
+  if (shift > 0) {
+    std::copy(versions.begin() + shift, versions.end(), versions.begin());
+    std::fill(versions.end() - shift, versions.end(), 0);
+  } else {
+    std::copy_backward(versions.begin(), versions.end() + shift, versions.end());
+    std::fill(versions.begin(), versions.begin() - shift, 0);
+  }
+}
 
-      // draw bg color
-      SDL_SetRenderDrawColor(renderer_, bg.r, bg.g, bg.b, background_image_opaque);
-      SDL_RenderFillRect(renderer_, &glyph_box);
+// Merge cells of the same background color into (color, x, w) runs in row_bg_rects_.
+void Display::collect_bg_runs(const Row &row_data, int max_cols, bool skip_clear_color) {
+  row_bg_rects_.clear();
+  int col = 0;
+  while (col < max_cols) {
+    Color color = cell_bg(row_data[col]);
+    int end = col + 1;
+    while (end < max_cols && cell_bg(row_data[end]).u32 == color.u32) {
+      end++;
+    }
+    if (!(skip_clear_color && color.u32 == clear_color_.u32)) {
+      row_bg_rects_.emplace_back(color, glyph_width_ * col, glyph_width_ * (end - col));
+    }
+    col = end;
+  }
+}
 
-      // get to character's cached texture
-      uint32_t style = TTF_STYLE_NORMAL;
-      if (c.attr.test(CHAR_ATTR_UNDERLINE)) {
-        style |= TTF_STYLE_UNDERLINE;
+// Runs of non-blank cells of one style that need shaping into row_shaped_runs_: runs with two ligature
+//  candidates in a row or with a character of a script that needs shaping.
+// Plain text has none and keeps the per cell glyph path.
+void Display::collect_shaped_runs(const Row &row_data, int max_cols) {
+  row_shaped_runs_.clear();
+  int col = 0;
+  while (col < max_cols) {
+    auto &c = row_data[col];
+    if (char_is_blank(c)) {
+      col++;
+      continue;
+    }
+    uint32_t style = char_style(c);
+    int end = col + 1;
+    bool shape = false;
+    // run slices are one cell wide, double width characters are drawn on their own
+    if (c.attr.test(CHAR_ATTR_WIDE)) {
+      col++;
+      continue;
+    }
+    while (end < max_cols && end - col < FontCache::max_run_cells && !char_is_blank(row_data[end])
+        && !row_data[end].attr.test(CHAR_ATTR_WIDE) && char_style(row_data[end]) == style) {
+      end++;
+    }
+    for (int i = col; i < end && !shape; i++) {
+      auto &cell = row_data[i];
+      if ((uint8_t) cell.c[0] >= 0x80u) {
+        shape = needs_shaping(utf8_decode(cell.c));
+      } else {
+        shape = i + 1 < end && is_ligature_candidate(cell) && is_ligature_candidate(row_data[i + 1]);
       }
-      if (c.attr.test(CHAR_ATTR_BOLD)) {
-        style |= TTF_STYLE_BOLD;
+    }
+    if (shape && end - col > 1) {
+      row_shaped_runs_.emplace_back(col, end);
+    }
+    col = end;
+  }
+}
+
+// the selection is only drawn in the focused pane
+template <typename F>
+void Display::for_each_overlay_cell(const Pane &pane, int max_rows, int max_cols, F draw_cell) {
+  const auto &snapshot = *pane.frame_snapshot;
+  if (has_selection && &pane == &focused_pane()) {
+    auto start = std::make_tuple(selection_start_row, selection_start_col),
+        end = std::make_tuple(selection_end_row, selection_end_col);
+    if (less_than(end, start)) {
+      std::swap(start, end);
+    }
+    for (int row = std::max(0, std::get<0>(start)); row <= std::get<0>(end) && row < max_rows; row++) {
+      int from_col = row == std::get<0>(start) ? std::get<1>(start) : 0;
+      int to_col = row == std::get<0>(end) ? std::get<1>(end) : max_cols - 1;
+      for (int col = std::max(0, from_col); col <= to_col && col < max_cols; col++) {
+        draw_cell(row, col, selection_fg_color, selection_bg_color);
+      }
+    }
+  }
+
+  bool cursor_visible = snapshot.cursor_show && (!snapshot.cursor_blink || cursor_flip_);
+  if (cursor_visible && snapshot.cursor_row < max_rows && snapshot.cursor_col < max_cols) {
+    draw_cell(snapshot.cursor_row, snapshot.cursor_col, snapshot.cursor_fg_color, snapshot.cursor_color);
+  }
+}
+
+// selection and cursor, drawn over the frame of the pane
+void Display::render_overlay(const Pane &pane, int max_rows, int max_cols) {
+  const auto &snapshot = *pane.frame_snapshot;
+  for_each_overlay_cell(pane, max_rows, max_cols, [&](int row, int col, Color fg, Color bg) {
+    auto &c = (*snapshot.rows[row])[col];
+    if (c.attr.test(CHAR_ATTR_WIDE_SPACER)) {
+      // covered by the double width cell
+      return;
+    }
+    fg = map_color(fg);
+    bg = map_color(bg);
+    SDL_Rect box{pane.x + glyph_width_ * col, pane.y + glyph_height_ * row, glyph_width_ * char_columns(c), glyph_height_};
+    SDL_SetRenderDrawColor(renderer_, bg.r, bg.g, bg.b, 0xff);
+    SDL_RenderFillRect(renderer_, &box);
+    draw_calls_++;
+    if (!char_is_blank(c)) {
+      if (auto glyph = font_cache_->get(char_style(c), c.c)) {
+        font_cache_->draw(*glyph, box.x, box.y, box.w, box.h, fg);
+      }
+    }
+  });
+  font_cache_->flush();
+}
+
+// Refresh the HUD text, at most once per hud_interval_ so the numbers stay readable.
+void Display::update_hud(const ScreenSnapshot &snapshot) {
+  auto now = std::chrono::high_resolution_clock::now();
+  if (!hud_lines_.empty() && now - hud_last_update_ < hud_interval_) {
+    return;
+  }
+  double seconds = std::max(1e-3, std::chrono::duration<double>(now - hud_last_update_).count());
+  uint64_t bytes = stats_.bytes(), hits = font_cache_->hits(), misses = font_cache_->misses();
+  uint64_t lookups = hits - hud_last_hits_ + misses - hud_last_misses_;
+  int pty_queued = 0;
+  ioctl(focused_session().tty_fd(), FIONREAD, &pty_queued);
+
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(2);
+  hud_lines_.clear();
+  auto add_line = [&]() {
+    hud_lines_.push_back(out.str());
+    out.str("");
+  };
+  out << "parse  " << (bytes - hud_last_bytes_) / seconds / 1e6 << " MB/s";
+  add_line();
+  out << "frame  " << std::chrono::duration<double, std::milli>(last_frame_time_).count() << " ms";
+  add_line();
+  out << "draws  " << last_frame_draw_calls_ << " per frame";
+  add_line();
+  out << "glyphs " << std::setprecision(1) << (lookups ? 100.0 * (hits - hud_last_hits_) / lookups : 100.0)
+      << "% hit, " << font_cache_->size() << " cached, " << font_cache_->memory_bytes() / 1e6 << " MB";
+  add_line();
+  out << "buffer " << snapshot.buffer_rows << " rows, " << snapshot.buffer_bytes / 1e6 << " MB";
+  add_line();
+  out << "pty    " << pty_queued << " bytes queued, " << reactor_->backend() << ", "
+      << (focused_session().throughput_mode() ? "throughput" : "latency") << " mode";
+  add_line();
+  if (size_t paste = focused_session().pending_paste()) {
+    out << "paste  " << paste / 1e6 << " MB left";
+    add_line();
+  }
+
+  hud_last_update_ = now;
+  hud_last_bytes_ = bytes;
+  hud_last_hits_ = hits;
+  hud_last_misses_ = misses;
+}
+
+// The HUD lines in the top right corner of the pane, one background rect and one glyph batch.
+void Display::render_hud(Pane &pane, int max_rows, int max_cols) {
+  if (!hud_visible_ || hud_lines_.empty()) {
+    return;
+  }
+  size_t width = 0;
+  for (auto &line : hud_lines_) {
+    width = std::max(width, line.size());
+  }
+  // one column of padding on both sides
+  int cols = std::min<int>(width + 2, max_cols), rows = std::min<int>(hud_lines_.size(), max_rows);
+  int col0 = max_cols - cols;
+  draw_rect(pane.x + glyph_width_ * col0, pane.y, glyph_width_ * cols, glyph_height_ * rows, hud_bg_color_);
+  for (int row = 0; row < rows; row++) {
+    draw_text(pane.x + glyph_width_ * (col0 + 1), pane.y + glyph_height_ * row, max_cols - col0 - 1, hud_lines_[row], hud_fg_color_);
+    if (software_compositor_) {
+      // drawn again with the rows below next frame
+      pane.software_overlay_rows.push_back(row);
+    }
+  }
+  if (!software_compositor_) {
+    font_cache_->flush();
+  }
+}
+
+// Separators between the panes of the active tab, and the tab bar when there is more than one tab.
+// The software path keeps the separators in the framebuffer, the tab bar is drawn every frame for its titles.
+void Display::render_layout() {
+  if (!software_compositor_ || layout_damaged_) {
+    for (auto &[x, y, w, h] : separators_) {
+      draw_rect(x, y, w, h, separator_color_);
+    }
+  }
+  if (tabs_.size() < 2) {
+    return;
+  }
+  draw_rect(0, 0, resolution_w_, glyph_height_, tab_bg_color_);
+  int tab_cols = std::max<int>(1, resolution_w_ / glyph_width_ / tabs_.size());
+  for (size_t i = 0; i < tabs_.size(); i++) {
+    bool active = i == active_tab_;
+    int x = glyph_width_ * tab_cols * i;
+    if (active) {
+      draw_rect(x, 0, glyph_width_ * tab_cols, glyph_height_, active_tab_bg_color_);
+    }
+    // sessions of hidden tabs keep the title of their last published snapshot
+    auto title = std::to_string(i + 1) + " " + tabs_[i].focused->session->snapshot()->window_title;
+    draw_text(x + glyph_width_, 0, tab_cols - 2, title, active ? active_tab_fg_color_ : tab_fg_color_);
+  }
+  if (!software_compositor_) {
+    font_cache_->flush();
+  }
+}
+
+void Display::draw_rect(int x, int y, int w, int h, Color color) {
+  if (software_compositor_) {
+    software_compositor_->fill_rect(x, y, w, h, color);
+  } else {
+    SDL_Rect rect{x, y, w, h};
+    SDL_SetRenderDrawColor(renderer_, color.r, color.g, color.b, 0xff);
+    SDL_RenderFillRect(renderer_, &rect);
+    draw_calls_++;
+  }
+}
+
+// One cell per utf8 sequence, the glyphs are batched until the caller flushes the font cache.
+void Display::draw_text(int x, int y, int max_cols, std::string_view text, Color color) {
+  std::string c;
+  for (size_t i = 0, col = 0; i < text.size() && col < max_cols; col++) {
+    int n = utf8_length(text[i]);
+    c.assign(text.substr(i, n));
+    i += n;
+    if (c == " ") {
+      continue;
+    }
+    int cell_x = x + glyph_width_ * col;
+    if (software_compositor_) {
+      if (auto bitmap = font_cache_->get_bitmap(TTF_STYLE_NORMAL, c)) {
+        software_compositor_->blend_mask(cell_x, y, glyph_width_, glyph_height_, bitmap->alpha.data(), bitmap->w, bitmap->h, color);
       }
-      if (c.attr.test(CHAR_ATTR_ITALIC)) {
-        style |= TTF_STYLE_ITALIC;
+    } else if (auto glyph = font_cache_->get(TTF_STYLE_NORMAL, c)) {
+      font_cache_->draw(*glyph, cell_x, y, glyph_width_, glyph_height_, color);
+    }
+  }
+}
+
+// Software path of render_chars: the panes are composited into the window sized framebuffer of
+//  software_compositor_ with the same row versioning as the frame textures, scrolling moves the rows of a pane.
+// Only the framebuffer rows written in this frame are uploaded.
+void Display::render_software() {
+  int w = resolution_w_, h = resolution_h_;
+  if (!software_texture_ || w != software_compositor_->width() || h != software_compositor_->height()) {
+    if (software_texture_) {
+      SDL_DestroyTexture(software_texture_);
+    }
+    software_texture_ = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, w, h);
+    if (!software_texture_) {
+      std::cerr << "Failed to create framebuffer texture: " << SDL_GetError() << std::endl;
+      abort();
+    }
+    SDL_SetTextureBlendMode(software_texture_, SDL_BLENDMODE_NONE);
+    software_compositor_->resize(w, h);
+    layout_damaged_ = true;
+  }
+  if (layout_damaged_) {
+    // the window background shows between the panes
+    if (background_layer_.empty()) {
+      software_compositor_->fill_rect(0, 0, w, h, clear_color_);
+    } else {
+      software_compositor_->copy_rows(0, 0, w, h, &background_layer_[0].u32, background_layer_w_);
+    }
+    for (auto pane : visible_panes_) {
+      pane->frame_row_versions.clear();
+      pane->software_overlay_rows.clear();
+    }
+  }
+
+  for (auto pane : visible_panes_) {
+    render_pane_software(*pane);
+  }
+  render_layout();
+  layout_damaged_ = false;
+
+  software_compositor_->upload(software_texture_);
+  SDL_Rect frame_rect{0, 0, w, h};
+  SDL_RenderCopy(renderer_, software_texture_, nullptr, &frame_rect);
+  draw_calls_++;
+}
+
+void Display::render_pane_software(Pane &pane) {
+  const auto &snapshot = *pane.frame_snapshot;
+  update_color_lut(pane);
+  int max_rows = std::min(pane.rows, snapshot.max_rows), max_cols = std::min(pane.cols, snapshot.max_cols);
+  if (max_cols != pane.frame_cols) {
+    pane.frame_cols = max_cols;
+    pane.frame_row_versions.clear();
+  }
+  if (pane.frame_row_versions.size() != max_rows || snapshot.alternate_screen != pane.frame_alternate_screen) {
+    pane.frame_row_versions.assign(max_rows, 0);
+  }
+  // restore the rows under the last cursor and selection, before they are moved by scrolling
+  for (int row : pane.software_overlay_rows) {
+    if (row < pane.frame_row_versions.size()) {
+      pane.frame_row_versions[row] = 0;
+    }
+  }
+  pane.software_overlay_rows.clear();
+
+  int frame_w = glyph_width_ * max_cols;
+  int64_t delta = snapshot.scroll_offset - pane.frame_scroll_offset;
+  if (delta != 0) {
+    if (std::abs(delta) < max_rows) {
+      int shift = delta;
+      int h = glyph_height_ * (max_rows - std::abs(shift));
+      if (shift > 0) {
+        software_compositor_->move_rows(pane.x, frame_w, pane.y + glyph_height_ * shift, pane.y, h);
+      } else {
+        software_compositor_->move_rows(pane.x, frame_w, pane.y, pane.y + glyph_height_ * -shift, h);
       }
-      if (TTF_GetFontStyle(font_) != style) {
-        TTF_SetFontStyle(font_, style);
+      scroll_frame_row_versions(pane, shift);
+    } else {
+      std::fill(pane.frame_row_versions.begin(), pane.frame_row_versions.end(), 0);
+    }
+  }
+  pane.frame_scroll_offset = snapshot.scroll_offset;
+  pane.frame_alternate_screen = snapshot.alternate_screen;
+
+  for (int row = 0; row < max_rows; row++) {
+    const auto &row_data = *snapshot.rows[row];
+    if (pane.frame_row_versions[row] == row_data.version()) {
+      continue;
+    }
+    bool complete = render_row_software(row_data, pane.x, pane.y + glyph_height_ * row, max_cols);
+    pane.frame_row_versions[row] = complete ? row_data.version() : 0;
+  }
+
+  for_each_overlay_cell(pane, max_rows, max_cols, [&](int row, int col, Color fg, Color bg) {
+    auto &c = (*snapshot.rows[row])[col];
+    if (c.attr.test(CHAR_ATTR_WIDE_SPACER)) {
+      return;
+    }
+    int x = pane.x + glyph_width_ * col, y = pane.y + glyph_height_ * row, w = glyph_width_ * char_columns(c);
+    software_compositor_->fill_rect(x, y, w, glyph_height_, map_color(bg));
+    if (!char_is_blank(c)) {
+      if (auto bitmap = font_cache_->get_bitmap(char_style(c), c.c)) {
+        software_compositor_->blend_mask(x, y, w, glyph_height_, bitmap->alpha.data(), bitmap->w, bitmap->h, map_color(fg));
       }
+    }
+    if (pane.software_overlay_rows.empty() || pane.software_overlay_rows.back() != row) {
+      pane.software_overlay_rows.push_back(row);
+    }
+  });
+
+  if (&pane == &focused_pane()) {
+    render_hud(pane, max_rows, max_cols);
+  }
+}
+
+// Composite one row at (x, y) into the framebuffer, returns false if some glyphs are not rasterized yet.
+bool Display::render_row_software(const Row &row_data, int x, int y, int max_cols) {
+  int w = glyph_width_ * max_cols;
+  if (background_layer_.empty()) {
+    software_compositor_->fill_rect(x, y, w, glyph_height_, clear_color_);
+  } else {
+    software_compositor_->copy_rows(x, y, w, glyph_height_, &background_layer_[(size_t) y * background_layer_w_ + x].u32, background_layer_w_);
+  }
+
+  bool has_image = !background_layer_.empty();
+  collect_bg_runs(row_data, max_cols, !has_image);
+  for (auto &[color, run_x, run_w] : row_bg_rects_) {
+    if (has_image) {
+      software_compositor_->blend_rect(x + run_x, y, run_w, glyph_height_, color, background_image_opaque);
+    } else {
+      software_compositor_->fill_rect(x + run_x, y, run_w, glyph_height_, color);
+    }
+  }
 
-      if (c.c.empty() || (c.c.size() == 1 && c.c[0] == 0 || c.c[0] == ' ')) {
+  bool complete = true;
+  int glyph_cols = std::min(max_cols, row_data.blank_from());
+  collect_shaped_runs(row_data, glyph_cols);
+  std::vector<const GlyphRasterizer::Bitmap*> run_bitmaps;
+  size_t next_run = 0;
+  for (int col = 0; col < glyph_cols; col++) {
+    if (next_run < row_shaped_runs_.size() && std::get<0>(row_shaped_runs_[next_run]) == col) {
+      auto [start, end] = row_shaped_runs_[next_run++];
+      auto status = font_cache_->get_run_bitmaps(char_style(row_data[col]), run_text(row_data, start, end), end - start, run_bitmaps);
+      if (status == FontCache::RunStatus::READY) {
+        for (int i = start; i < end; i++) {
+          auto bitmap = run_bitmaps[i - start];
+          software_compositor_->blend_mask(x + glyph_width_ * i, y, glyph_width_, glyph_height_, bitmap->alpha.data(), bitmap->w, bitmap->h, cell_fg(row_data[i]));
+        }
+        col = end - 1;
         continue;
       }
+      complete = complete && status != FontCache::RunStatus::PENDING;
+    }
+    auto &c = row_data[col];
+    if (char_is_blank(c)) {
+      continue;
+    }
+    auto bitmap = font_cache_->get_bitmap(char_style(c), c.c);
+    if (!bitmap) {
+      complete = false;
+      continue;
+    }
+    software_compositor_->blend_mask(x + glyph_width_ * col,
+                                     y,
+                                     glyph_width_ * char_columns(c),
+                                     glyph_height_,
+                                     bitmap->alpha.data(),
+                                     bitmap->w,
+                                     bitmap->h,
+                                     cell_fg(c));
+  }
+  return complete;
+}
 
-      auto texture = font_cache_->at(std::make_tuple(style, c.c));
-      if (!texture) {
-        texture = font_cache_->at(std::make_tuple(style, "?"));
-        assert(texture);
-      }
+void Display::clear_frame_textures(Pane &pane) {
+  for (auto &texture : pane.frame_textures) {
+    if (texture) {
+      SDL_DestroyTexture(texture);
+      texture = nullptr;
+    }
+  }
+  pane.frame_texture_w = pane.frame_texture_h = 0;
+  pane.frame_row_versions.clear();
+}
+
+void Display::clear_frame_textures() {
+  for (auto &tab : tabs_) {
+    for_each_pane(*tab.root, [&](Pane &pane) { clear_frame_textures(pane); });
+  }
+  if (software_texture_) {
+    SDL_DestroyTexture(software_texture_);
+    software_texture_ = nullptr;
+  }
+}
 
-      SDL_SetTextureColorMod(texture, fg.r, fg.g, fg.b);
-      SDL_RenderCopy(renderer_, texture, NULL, &glyph_box);
+void Display::clear_row_textures() {
+  for (auto &[version, row_texture] : row_textures_) {
+    if (row_texture.texture) {
+      SDL_DestroyTexture(row_texture.texture);
     }
   }
+  row_textures_.clear();
+  for (auto &row_texture : free_row_textures_) {
+    SDL_DestroyTexture(row_texture.texture);
+  }
+  free_row_textures_.clear();
 }
 }
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include <te/glyph_disk_cache.hpp>
+
+#include <cstring>
+
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace te {
+
+/**
+ * File format, all integers are little endian
+ *
+ * header: "TEGLYPH1"
+ * records, 4 bytes aligned:
+ *   RecordHeader
+ *   key (key_len bytes)
+ *   alpha (w * h bytes)
+ */
+constexpr char glyph_cache_magic[8] = {'T', 'E', 'G', 'L', 'Y', 'P', 'H', '1'};
+
+#pragma pack(push, 1)
+struct RecordHeader {
+  // total size including this header and padding
+  uint32_t size;
+  uint16_t key_len;
+  uint16_t w;
+  uint16_t h;
+  uint16_t reserved;
+};
+#pragma pack(pop)
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+  auto p = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+std::string GlyphDiskCache::default_path(const std::vector<std::string> &font_paths, int font_size, int dpi) {
+  std::filesystem::path dir;
+  if (auto xdg_cache_home = getenv("XDG_CACHE_HOME"); xdg_cache_home && *xdg_cache_home) {
+    dir = xdg_cache_home;
+  } else if (auto home = getenv("HOME"); home && *home) {
+    dir = std::filesystem::path(home) / ".cache";
+  } else {
+    return "";
+  }
+
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (const auto &path : font_paths) {
+    // a font replaced or updated in place gets a new inode, size or mtime and so a new cache file, without
+    //  reading the font files at startup
+    struct stat st{};
+    if (stat(path.c_str(), &st) == 0) {
+      uint64_t identity[] = {(uint64_t) st.st_dev, (uint64_t) st.st_ino, (uint64_t) st.st_size,
+                             (uint64_t) st.st_mtim.tv_sec, (uint64_t) st.st_mtim.tv_nsec};
+      hash = fnv1a(hash, identity, sizeof(identity));
+    }
+    hash = fnv1a(hash, path.data(), path.size());
+  }
+  hash = fnv1a(hash, &font_size, sizeof(font_size));
+  hash = fnv1a(hash, &dpi, sizeof(dpi));
+
+  std::stringstream ss;
+  ss << "glyphs-" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+  return (dir / "te" / ss.str()).string();
+}
+
+GlyphDiskCache::GlyphDiskCache(const std::string &path) {
+  if (path.empty()) {
+    return;
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    std::cerr << "Warning, glyph disk cache disabled, failed to open '" << path << "': " << strerror(errno) << std::endl;
+    return;
+  }
+
+  flock(fd_, LOCK_EX);
+  struct stat st{};
+  if (fstat(fd_, &st) == 0 && st.st_size == 0) {
+    if (write(fd_, glyph_cache_magic, sizeof(glyph_cache_magic)) != sizeof(glyph_cache_magic)) {
+      perror("write glyph cache header");
+    }
+  }
+  flock(fd_, LOCK_UN);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  refresh();
+  if (map_size_ < sizeof(glyph_cache_magic) || memcmp(map_, glyph_cache_magic, sizeof(glyph_cache_magic)) != 0) {
+    std::cerr << "Warning, glyph disk cache disabled, invalid file '" << path << "'" << std::endl;
+    if (map_) {
+      munmap((void*) map_, map_size_);
+      map_ = nullptr;
+    }
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+GlyphDiskCache::~GlyphDiskCache() {
+  if (map_) {
+    munmap((void*) map_, map_size_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+void GlyphDiskCache::refresh() {
+  struct stat st{};
+  if (fstat(fd_, &st) < 0 || (size_t) st.st_size == map_size_) {
+    return;
+  }
+  if (map_) {
+    munmap((void*) map_, map_size_);
+    map_ = nullptr;
+    map_size_ = 0;
+  }
+  auto map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+  if (map == MAP_FAILED) {
+    perror("mmap glyph cache");
+    return;
+  }
+  map_ = static_cast<const uint8_t*>(map);
+  map_size_ = st.st_size;
+
+  size_t offset = std::max(scanned_, sizeof(glyph_cache_magic));
+  while (offset + sizeof(RecordHeader) <= map_size_) {
+    RecordHeader header{};
+    memcpy(&header, map_ + offset, sizeof(header));
+    if (header.size < sizeof(header) + header.key_len + header.w * header.h || offset + header.size > map_size_) {
+      // a record being appended, or the tail of a crashed writer
+      break;
+    }
+    std::string key(reinterpret_cast<const char*>(map_ + offset + sizeof(header)), header.key_len);
+    index_[std::move(key)] = offset;
+    offset += header.size;
+  }
+  scanned_ = offset;
+}
+
+bool GlyphDiskCache::lookup(const std::string &key, GlyphRasterizer::Bitmap &bitmap) {
+  if (!ok()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    // another process might have added it
+    refresh();
+    it = index_.find(key);
+    if (it == index_.end()) {
+      return false;
+    }
+  }
+  RecordHeader header{};
+  memcpy(&header, map_ + it->second, sizeof(header));
+  auto alpha = map_ + it->second + sizeof(header) + header.key_len;
+  bitmap.key = key;
+  bitmap.ok = true;
+  bitmap.w = header.w;
+  bitmap.h = header.h;
+  bitmap.alpha.assign(alpha, alpha + header.w * header.h);
+  return true;
+}
+
+void GlyphDiskCache::store(const GlyphRasterizer::Bitmap &bitmap) {
+  if (!ok() || !bitmap.ok) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  flock(fd_, LOCK_EX);
+  refresh();
+  if (index_.find(bitmap.key) == index_.end()) {
+    struct stat st{};
+    if (fstat(fd_, &st) == 0 && (size_t) st.st_size > scanned_) {
+      // drop the partial record of a crashed writer, we hold the lock so nobody else is appending
+      if (ftruncate(fd_, scanned_) < 0) {
+        perror("ftruncate glyph cache");
+      }
+    }
+
+    RecordHeader header{};
+    size_t size = sizeof(header) + bitmap.key.size() + bitmap.alpha.size();
+    header.size = (size + 3u) & ~3u;
+    header.key_len = bitmap.key.size();
+    header.w = bitmap.w;
+    header.h = bitmap.h;
+    std::vector<uint8_t> record(header.size, 0);
+    memcpy(record.data(), &header, sizeof(header));
+    memcpy(record.data() + sizeof(header), bitmap.key.data(), bitmap.key.size());
+    memcpy(record.data() + sizeof(header) + bitmap.key.size(), bitmap.alpha.data(), bitmap.alpha.size());
+    // O_APPEND, a single write per record
+    if (write(fd_, record.data(), record.size()) != (ssize_t) record.size()) {
+      perror("write glyph cache");
+    }
+  }
+  flock(fd_, LOCK_UN);
+}
+
+}
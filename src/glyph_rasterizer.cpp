@@ -0,0 +1,133 @@
+#include <te/glyph_rasterizer.hpp>
+
+#include <iostream>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include <te/glyph_disk_cache.hpp>
+
+namespace te {
+
+GlyphRasterizer::GlyphRasterizer(const std::vector<std::string> &font_paths,
+                                 int font_size,
+                                 int max_width,
+                                 int max_height,
+                                 int n_workers,
+                                 GlyphDiskCache *disk_cache)
+    :max_width_(max_width), max_height_(max_height), disk_cache_(disk_cache) {
+  // fonts are opened here, FreeType face creation is not thread safe
+  for (int i = 0; i < n_workers; i++) {
+    auto &fonts = fonts_.emplace_back();
+    for (const auto &path : font_paths) {
+      auto font = TTF_OpenFont(path.c_str(), font_size);
+      if (!font) {
+        std::cerr << "Error loading font for glyph rasterizer '" << path << "': " << TTF_GetError() << std::endl;
+        abort();
+      }
+      fonts.push_back(font);
+    }
+  }
+  for (int i = 0; i < n_workers; i++) {
+    workers_.emplace_back([this, i]() { worker_loop(i); });
+  }
+}
+
+GlyphRasterizer::~GlyphRasterizer() {
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex_);
+    stop_ = true;
+  }
+  jobs_cv_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+  for (auto &fonts : fonts_) {
+    for (auto font : fonts) {
+      TTF_CloseFont(font);
+    }
+  }
+}
+
+void GlyphRasterizer::submit(Job job) {
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex_);
+    jobs_.push_back(std::move(job));
+  }
+  jobs_cv_.notify_one();
+}
+
+void GlyphRasterizer::collect(std::vector<Bitmap> &results) {
+  std::lock_guard<std::mutex> lock(results_mutex_);
+  for (auto &bitmap : results_) {
+    results.push_back(std::move(bitmap));
+  }
+  results_.clear();
+}
+
+void GlyphRasterizer::worker_loop(int index) {
+  auto &fonts = fonts_[index];
+  SDL_Color white_color{0xff,0xff,0xff,0xff};
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(jobs_mutex_);
+      jobs_cv_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+      if (stop_) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+
+    Bitmap bitmap;
+    if (disk_cache_ && disk_cache_->lookup(job.key, bitmap)) {
+      // rasterized before, by this or another te process
+      std::lock_guard<std::mutex> lock(results_mutex_);
+      results_.push_back(std::move(bitmap));
+      continue;
+    }
+    bitmap.key = std::move(job.key);
+    auto font = fonts[job.font];
+    if (TTF_GetFontStyle(font) != job.style) {
+      TTF_SetFontStyle(font, job.style);
+    }
+    SDL_Surface *text_surf = TTF_RenderUTF8_Blended(font, job.c.c_str(), white_color);
+    if (text_surf) {
+      SDL_Surface *argb = text_surf;
+      if (text_surf->format->format != SDL_PIXELFORMAT_ARGB8888) {
+        argb = SDL_ConvertSurfaceFormat(text_surf, SDL_PIXELFORMAT_ARGB8888, 0);
+      }
+      if (argb) {
+        bitmap.ok = true;
+        bitmap.w = std::min(argb->w, job.max_width ? job.max_width : max_width_);
+        bitmap.h = std::min(argb->h, max_height_);
+        bitmap.alpha.resize(bitmap.w * bitmap.h);
+        for (int y = 0; y < bitmap.h; y++) {
+          auto line = reinterpret_cast<const uint32_t*>((const uint8_t*) argb->pixels + y * argb->pitch);
+          for (int x = 0; x < bitmap.w; x++) {
+            bitmap.alpha[y * bitmap.w + x] = line[x] >> 24u;
+          }
+        }
+        if (argb != text_surf) {
+          SDL_FreeSurface(argb);
+        }
+      } else {
+        bitmap.error = SDL_GetError();
+      }
+      SDL_FreeSurface(text_surf);
+    } else {
+      // the SDL error state is per thread, the render thread reports it
+      bitmap.error = TTF_GetError();
+    }
+    if (disk_cache_) {
+      // share with other te processes
+      disk_cache_->store(bitmap);
+    }
+
+    std::lock_guard<std::mutex> lock(results_mutex_);
+    results_.push_back(std::move(bitmap));
+  }
+}
+
+}
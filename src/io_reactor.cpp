@@ -0,0 +1,874 @@
+#include <te/io_reactor.hpp>
+
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <te/session.hpp>
+
+namespace te {
+
+/**
+ * Worker, the part shared by both backends
+ */
+class IOReactor::Worker {
+ public:
+  Worker() {
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup_fd_ < 0) {
+      perror("eventfd");
+      abort();
+    }
+  }
+
+  virtual ~Worker() {
+    close(wakeup_fd_);
+  }
+
+  void start() {
+    thread_ = std::thread([this]() { loop(); });
+  }
+
+  void stop() {
+    stop_ = true;
+    wakeup();
+    thread_.join();
+  }
+
+  void add(Session *session, int tty_fd, int pid_fd) {
+    auto entry = new Entry;
+    entry->session = session;
+    entry->tty_fd = tty_fd;
+    entry->pid_fd = pid_fd;
+    entry->buffer = std::make_unique<char[]>(2 * read_size);
+    n_sessions_++;
+    {
+      std::lock_guard lock(mutex_);
+      added_.push_back(entry);
+    }
+    wakeup();
+  }
+
+  void remove(Session *session) {
+    uint64_t request;
+    {
+      std::lock_guard lock(mutex_);
+      removed_.push_back(session);
+      request = ++remove_requests_;
+    }
+    wakeup();
+    std::unique_lock lock(mutex_);
+    removed_cv_.wait(lock, [&]() { return removes_done_ >= request; });
+    n_sessions_--;
+  }
+
+  void wakeup(Session *session) {
+    // a session is queued once until it is serviced
+    if (session->reactor_wakeup_pending_.exchange(true)) {
+      return;
+    }
+    {
+      std::lock_guard lock(mutex_);
+      woken_.push_back(session);
+      woken_pending_ = true;
+    }
+    wakeup();
+  }
+
+  int n_sessions() const {
+    return n_sessions_;
+  }
+
+  virtual const char *backend() const = 0;
+
+ protected:
+  struct Entry {
+    // nullptr once removed, the entry lives on until the kernel is done with its buffers
+    Session *session;
+    int tty_fd, pid_fd;
+    // two halves of read_size, the kernel fills one while the other is parsed
+    std::unique_ptr<char[]> buffer;
+    int half = 0;
+    // output being written from output_offset, and the output taken from the session while it is written
+    std::string output, queued_output;
+    size_t output_offset = 0;
+    // the tty hung up, nothing is read anymore
+    bool hung_up = false;
+    // epoll: data may be left after the last turn / waiting for EPOLLOUT
+    bool ready = false, want_write = false;
+    // io_uring: bit per Op in flight
+    uint32_t inflight = 0;
+    // waits in deferred_
+    bool deferred = false;
+  };
+
+  virtual void loop() = 0;
+  // start and stop serving entry
+  virtual void attach(Entry &entry) = 0;
+  virtual void detach(Entry &entry) = 0;
+  // write entry.output, then entry.queued_output
+  virtual void flush(Entry &entry) = 0;
+
+  void wakeup() const {
+    uint64_t n = 1;
+    if (write(wakeup_fd_, &n, sizeof(n)) < 0) {
+      perror("write eventfd");
+    }
+  }
+
+  void drain_wakeup() const {
+    uint64_t n;
+    if (read(wakeup_fd_, &n, sizeof(n)) < 0 && errno != EAGAIN) {
+      perror("read eventfd");
+    }
+  }
+
+  // sessions added, removed and woken up by other threads since the last call
+  void apply_changes() {
+    std::vector<Entry*> added;
+    std::vector<Session*> removed;
+    uint64_t remove_requests;
+    {
+      std::lock_guard lock(mutex_);
+      added.swap(added_);
+      removed.swap(removed_);
+      remove_requests = remove_requests_;
+    }
+    for (auto entry : added) {
+      entries_[entry->session] = entry;
+      attach(*entry);
+    }
+    for (auto session : removed) {
+      auto it = entries_.find(session);
+      if (it != entries_.end()) {
+        auto entry = it->second;
+        entries_.erase(it);
+        if (entry->deferred) {
+          deferred_.erase(std::find(deferred_.begin(), deferred_.end(), entry));
+        }
+        entry->session = nullptr;
+        detach(*entry);
+      }
+    }
+    if (!removed.empty()) {
+      {
+        std::lock_guard lock(mutex_);
+        // the sessions are gone once remove() returns
+        std::erase_if(woken_, [&](Session *session) {
+          return std::find(removed.begin(), removed.end(), session) != removed.end();
+        });
+        removes_done_ = remove_requests;
+      }
+      removed_cv_.notify_all();
+    }
+    service_woken();
+  }
+
+  // Sessions woken up by other threads, mostly to write keystrokes. Called between the reads of a batch as well,
+  //  so keystrokes like Ctrl-C go out before the rest of a flood is parsed.
+  void service_woken() {
+    if (!woken_pending_) {
+      return;
+    }
+    std::vector<Session*> woken;
+    {
+      std::lock_guard lock(mutex_);
+      woken.swap(woken_);
+      woken_pending_ = false;
+    }
+    std::vector<Session*> later;
+    for (auto session : woken) {
+      auto it = entries_.find(session);
+      if (it != entries_.end()) {
+        session->reactor_wakeup_pending_ = false;
+        service(*it->second, true);
+      } else {
+        // added by the next apply_changes()
+        later.push_back(session);
+      }
+    }
+    if (!later.empty()) {
+      std::lock_guard lock(mutex_);
+      for (auto session : later) {
+        // removed sessions are dropped, a session waiting in added_ is serviced once it is attached
+        if (std::any_of(added_.begin(), added_.end(), [&](Entry *entry) { return entry->session == session; })) {
+          woken_.push_back(session);
+          woken_pending_ = true;
+        }
+      }
+    }
+  }
+
+  // publish what was parsed, apply resizes and write the output queued since the last call
+  void service(Entry &entry, bool caught_up) {
+    if (entry.session->service(caught_up) && !entry.deferred) {
+      if (deferred_.empty()) {
+        publish_deadline_ = std::chrono::high_resolution_clock::now() + Session::publish_interval;
+      }
+      entry.deferred = true;
+      deferred_.push_back(&entry);
+    }
+    if (take_output(entry)) {
+      flush(entry);
+    }
+  }
+
+  // publish the screens flooding sessions left unpublished, once publish_deadline_ passed
+  void publish_deferred() {
+    if (deferred_.empty() || std::chrono::high_resolution_clock::now() < publish_deadline_) {
+      return;
+    }
+    auto deferred = std::move(deferred_);
+    deferred_.clear();
+    for (auto entry : deferred) {
+      entry->deferred = false;
+      service(*entry, true);
+    }
+  }
+
+  // how long the worker may wait for events, -1 if nothing is deferred
+  std::chrono::nanoseconds publish_timeout() const {
+    if (deferred_.empty()) {
+      return std::chrono::nanoseconds(-1);
+    }
+    return std::max(std::chrono::nanoseconds(0), publish_deadline_ - std::chrono::high_resolution_clock::now());
+  }
+
+  // keystrokes and replies whenever there are some, the next chunk of a paste only once everything before it
+  //  is written, so a paste waits for the tty instead of piling up here and keystrokes overtake it
+  static bool take_output(Entry &entry) {
+    bool idle = entry.output.empty() && entry.queued_output.empty();
+    return entry.session->take_output(entry.queued_output, idle);
+  }
+
+  // n bytes read from the tty, 0 or -errno if it hung up
+  void received(Entry &entry, const char *data, ssize_t n) {
+    if (n > 0) {
+      entry.session->receive(data, n);
+    } else {
+      entry.hung_up = true;
+      entry.session->hangup();
+    }
+  }
+
+  // the part of a write that went through
+  static void wrote(Entry &entry, size_t n) {
+    entry.output_offset += n;
+    if (entry.output_offset == entry.output.size()) {
+      entry.output.clear();
+      entry.output_offset = 0;
+      if (entry.queued_output.empty()) {
+        take_output(entry);
+      }
+      entry.output.swap(entry.queued_output);
+    }
+  }
+
+  static void write_failed(Entry &entry, int error) {
+    std::cerr << "Failed to write to tty_fd: " << strerror(error) << std::endl;
+    entry.output.clear();
+    entry.queued_output.clear();
+    entry.output_offset = 0;
+  }
+
+  std::thread thread_;
+  std::atomic<bool> stop_ = false;
+  int wakeup_fd_ = -1;
+  std::atomic<int> n_sessions_ = 0;
+  // worker thread
+  std::unordered_map<Session*, Entry*> entries_;
+
+  // changes requested by other threads
+  std::mutex mutex_;
+  std::condition_variable removed_cv_;
+  std::vector<Entry*> added_;
+  std::vector<Session*> removed_, woken_;
+  std::atomic<bool> woken_pending_ = false;
+  uint64_t remove_requests_ = 0, removes_done_ = 0;
+
+  // sessions in throughput mode with screens to publish by publish_deadline_, worker thread
+  std::vector<Entry*> deferred_;
+  std::chrono::high_resolution_clock::time_point publish_deadline_;
+};
+
+/**
+ * epoll backend: level triggered readiness, reads and writes are syscalls of the worker
+ */
+class EpollWorker : public IOReactor::Worker {
+ public:
+  EpollWorker() {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+      perror("epoll_create1");
+      abort();
+    }
+    control(EPOLL_CTL_ADD, wakeup_fd_, EPOLLIN, 0);
+  }
+
+  ~EpollWorker() override {
+    close(epoll_fd_);
+  }
+
+  const char *backend() const override {
+    return "epoll";
+  }
+
+ private:
+  enum Kind : uint64_t {
+    KIND_TTY = 1,
+    KIND_PID = 2,
+  };
+
+  void control(int op, int fd, uint32_t events, uint64_t data) const {
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = data;
+    if (epoll_ctl(epoll_fd_, op, fd, &event) < 0 && op != EPOLL_CTL_DEL) {
+      perror("epoll_ctl");
+      abort();
+    }
+  }
+
+  void attach(Entry &entry) override {
+    control(EPOLL_CTL_ADD, entry.tty_fd, EPOLLIN, (uint64_t) &entry | KIND_TTY);
+    if (entry.pid_fd >= 0) {
+      control(EPOLL_CTL_ADD, entry.pid_fd, EPOLLIN, (uint64_t) &entry | KIND_PID);
+    }
+  }
+
+  void detach(Entry &entry) override {
+    if (!entry.hung_up) {
+      control(EPOLL_CTL_DEL, entry.tty_fd, 0, 0);
+    }
+    if (entry.pid_fd >= 0) {
+      control(EPOLL_CTL_DEL, entry.pid_fd, 0, 0);
+    }
+    if (entry.ready) {
+      ready_.erase(std::find(ready_.begin(), ready_.end(), &entry));
+    }
+    delete &entry;
+  }
+
+  void flush(Entry &entry) override {
+    if (entry.output.empty()) {
+      entry.output.swap(entry.queued_output);
+    }
+    while (!entry.output.empty()) {
+      ssize_t n = write(entry.tty_fd, entry.output.data() + entry.output_offset,
+                        entry.output.size() - entry.output_offset);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          // the rest goes out when the tty is writable again
+          if (!entry.want_write && !entry.hung_up) {
+            control(EPOLL_CTL_MOD, entry.tty_fd, EPOLLIN | EPOLLOUT, (uint64_t) &entry | KIND_TTY);
+            entry.want_write = true;
+          }
+          return;
+        }
+        write_failed(entry, errno);
+        break;
+      }
+      wrote(entry, n);
+    }
+    if (entry.want_write && !entry.hung_up) {
+      control(EPOLL_CTL_MOD, entry.tty_fd, EPOLLIN, (uint64_t) &entry | KIND_TTY);
+    }
+    entry.want_write = false;
+  }
+
+  // read up to read_budget bytes, the entry stays ready if there may be more
+  void read_turn(Entry &entry) {
+    size_t total = 0;
+    while (total < IOReactor::read_budget) {
+      auto t_read = std::chrono::high_resolution_clock::now();
+      ssize_t n = read(entry.tty_fd, entry.buffer.get(), IOReactor::read_size);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        entry.ready = false;
+        return;
+      }
+      if (n <= 0) {
+        // EIO after the child closed the tty
+        control(EPOLL_CTL_DEL, entry.tty_fd, 0, 0);
+        entry.ready = false;
+        received(entry, nullptr, 0);
+        return;
+      }
+      entry.session->stats_.record(LatencyStats::STAGE_PTY_READ,
+                                   std::chrono::high_resolution_clock::now() - t_read);
+      received(entry, entry.buffer.get(), n);
+      total += n;
+    }
+  }
+
+  void loop() override {
+    constexpr int max_events = 64;
+    epoll_event events[max_events];
+
+    while (!stop_) {
+      apply_changes();
+      publish_deferred();
+      // sessions with data left from their last turn only give the others a chance to become ready
+      int timeout_ms = 0;
+      if (ready_.empty()) {
+        auto timeout = publish_timeout();
+        timeout_ms = timeout.count() < 0 ? -1 : std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+      }
+      int n = epoll_wait(epoll_fd_, events, max_events, timeout_ms);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        perror("epoll_wait");
+        abort();
+      }
+      for (int i = 0; i < n; i++) {
+        if (events[i].data.u64 == 0) {
+          drain_wakeup();
+          continue;
+        }
+        auto &entry = *(Entry*) (events[i].data.u64 & ~(uint64_t) 7);
+        if ((events[i].data.u64 & 7) == KIND_PID) {
+          control(EPOLL_CTL_DEL, entry.pid_fd, 0, 0);
+          entry.pid_fd = -1;
+          entry.session->child_exited();
+          continue;
+        }
+        if (events[i].events & EPOLLOUT) {
+          flush(entry);
+        }
+        if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !entry.ready && !entry.hung_up) {
+          entry.ready = true;
+          ready_.push_back(&entry);
+        }
+      }
+
+      // one turn for every ready session
+      for (auto entry : ready_) {
+        service_woken();
+        read_turn(*entry);
+        service(*entry, !entry->ready);
+      }
+      std::erase_if(ready_, [](Entry *entry) { return !entry->ready; });
+    }
+  }
+
+  int epoll_fd_ = -1;
+  // sessions in turn order
+  std::vector<Entry*> ready_;
+};
+
+/**
+ * io_uring backend: reads, writes and polls are submitted in batches and complete asynchronously
+ */
+class UringWorker : public IOReactor::Worker {
+ public:
+  // false if the kernel has no io_uring, or it is not allowed
+  bool setup() {
+    io_uring_params params{};
+    // hundreds of sessions have a few operations in flight each
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = 4096;
+    ring_fd_ = syscall(SYS_io_uring_setup, 256, &params);
+    if (ring_fd_ < 0) {
+      return false;
+    }
+    if (!(params.features & IORING_FEAT_NODROP)) {
+      return false;
+    }
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                    IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+      sq_ring_ = nullptr;
+      return false;
+    }
+    cq_ring_ = single_mmap ? sq_ring_ : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      cq_ring_ = nullptr;
+      return false;
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = (io_uring_sqe *) mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                  ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+      sqes_ = nullptr;
+      return false;
+    }
+
+    auto sq = (char *) sq_ring_, cq = (char *) cq_ring_;
+    sq_head_ = (std::atomic<uint32_t> *) (sq + params.sq_off.head);
+    sq_tail_ = (std::atomic<uint32_t> *) (sq + params.sq_off.tail);
+    sq_mask_ = *(uint32_t *) (sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_array_ = (uint32_t *) (sq + params.sq_off.array);
+    cq_head_ = (std::atomic<uint32_t> *) (cq + params.cq_off.head);
+    cq_tail_ = (std::atomic<uint32_t> *) (cq + params.cq_off.tail);
+    cq_mask_ = *(uint32_t *) (cq + params.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe *) (cq + params.cq_off.cqes);
+    local_sq_tail_ = sq_tail_->load(std::memory_order_relaxed);
+    return true;
+  }
+
+  ~UringWorker() override {
+    if (sqes_) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_) {
+      munmap(sq_ring_, sq_ring_size_);
+    }
+    if (ring_fd_ >= 0) {
+      close(ring_fd_);
+    }
+  }
+
+  const char *backend() const override {
+    return "io_uring";
+  }
+
+ private:
+  // user_data of an operation: entry pointer | op
+  enum Op : uint32_t {
+    OP_WAKEUP = 0,
+    OP_CANCEL = 1,
+    OP_READ = 2,
+    // the read found nothing, wait for the tty to become readable
+    OP_READ_POLL = 3,
+    OP_WRITE = 4,
+    OP_WRITE_POLL = 5,
+    OP_PID_POLL = 6,
+    // publish_deadline_
+    OP_TIMEOUT = 7,
+  };
+
+  io_uring_sqe &next_sqe() {
+    // enter() fails with EBUSY while the completion queue is full, its completions are set aside for the loop
+    while (unsubmitted() == sq_entries_) {
+      enter(0, 0);
+      if (unsubmitted() == sq_entries_) {
+        reap();
+      }
+    }
+    auto index = local_sq_tail_ & sq_mask_;
+    auto &sqe = sqes_[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sq_array_[index] = index;
+    local_sq_tail_++;
+    return sqe;
+  }
+
+  // submit the queued operations, and wait for min_complete completions
+  void enter(uint32_t min_complete, uint32_t flags) {
+    sq_tail_->store(local_sq_tail_, std::memory_order_release);
+    while (syscall(SYS_io_uring_enter, ring_fd_, unsubmitted(), min_complete, flags, nullptr, 0) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EBUSY || errno == EAGAIN) {
+        // the completion queue is full, the operations stay queued until it is drained
+        return;
+      }
+      perror("io_uring_enter");
+      abort();
+    }
+  }
+
+  // move the completions out of the ring into completions_
+  void reap() {
+    uint32_t head = cq_head_->load(std::memory_order_relaxed);
+    uint32_t tail = cq_tail_->load(std::memory_order_acquire);
+    for (; head != tail; head++) {
+      completions_.push_back(cqes_[head & cq_mask_]);
+    }
+    cq_head_->store(head, std::memory_order_release);
+  }
+
+  // queued operations the kernel has not consumed yet
+  uint32_t unsubmitted() const {
+    return local_sq_tail_ - sq_head_->load(std::memory_order_acquire);
+  }
+
+  void submit(Entry *entry, Op op, uint8_t opcode, int fd, const void *addr, uint32_t len,
+              uint32_t poll_events = 0) {
+    auto &sqe = next_sqe();
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t) addr;
+    sqe.len = len;
+    if (opcode == IORING_OP_READ || opcode == IORING_OP_WRITE) {
+      // at the current position, which ttys ignore
+      sqe.off = (uint64_t) -1;
+    }
+    sqe.poll32_events = poll_events;
+    sqe.user_data = (uint64_t) entry | op;
+    if (entry) {
+      entry->inflight |= 1u << op;
+    }
+  }
+
+  void submit_read(Entry &entry) {
+    submit(&entry, OP_READ, IORING_OP_READ, entry.tty_fd, entry.buffer.get() + entry.half * IOReactor::read_size,
+           IOReactor::read_size);
+  }
+
+  void submit_wakeup() {
+    submit(nullptr, OP_WAKEUP, IORING_OP_READ, wakeup_fd_, &wakeup_value_, sizeof(wakeup_value_));
+  }
+
+  void attach(Entry &entry) override {
+    submit_read(entry);
+    if (entry.pid_fd >= 0) {
+      submit(&entry, OP_PID_POLL, IORING_OP_POLL_ADD, entry.pid_fd, nullptr, 0, POLLIN);
+    }
+  }
+
+  // the buffers stay with the kernel until the canceled operations complete
+  void detach(Entry &entry) override {
+    for (uint32_t op = OP_READ; op <= OP_PID_POLL; op++) {
+      if (entry.inflight & (1u << op)) {
+        auto &sqe = next_sqe();
+        sqe.opcode = IORING_OP_ASYNC_CANCEL;
+        sqe.fd = -1;
+        sqe.addr = (uint64_t) &entry | op;
+        sqe.user_data = OP_CANCEL;
+      }
+    }
+    if (entry.inflight == 0) {
+      delete &entry;
+    } else {
+      detached_.insert(&entry);
+    }
+  }
+
+  void flush(Entry &entry) override {
+    if (entry.inflight & ((1u << OP_WRITE) | (1u << OP_WRITE_POLL))) {
+      // queued_output follows when the write completes
+      return;
+    }
+    if (entry.output.empty()) {
+      entry.output.swap(entry.queued_output);
+    }
+    if (!entry.output.empty()) {
+      submit(&entry, OP_WRITE, IORING_OP_WRITE, entry.tty_fd, entry.output.data() + entry.output_offset,
+             entry.output.size() - entry.output_offset);
+    }
+  }
+
+  void complete(const io_uring_cqe &cqe) {
+    auto op = (Op) (cqe.user_data & 7);
+    auto entry = (Entry *) (cqe.user_data & ~(uint64_t) 7);
+    if (op == OP_WAKEUP) {
+      drain_wakeup();
+      submit_wakeup();
+      return;
+    }
+    if (op == OP_CANCEL) {
+      return;
+    }
+    if (op == OP_TIMEOUT) {
+      timeout_pending_ = false;
+      return;
+    }
+    entry->inflight &= ~(1u << op);
+    if (!entry->session) {
+      if (entry->inflight == 0) {
+        detached_.erase(entry);
+        delete entry;
+      }
+      return;
+    }
+
+    switch (op) {
+      case OP_READ:
+        if (cqe.res == -EAGAIN || cqe.res == -EINTR) {
+          submit(entry, OP_READ_POLL, IORING_OP_POLL_ADD, entry->tty_fd, nullptr, 0, POLLIN);
+        } else {
+          // parsed once the next read is on its way into the other half
+          received_.emplace_back(entry, entry->buffer.get() + entry->half * IOReactor::read_size, cqe.res);
+          if (cqe.res > 0) {
+            entry->half ^= 1;
+            submit_read(*entry);
+          }
+        }
+        break;
+      case OP_READ_POLL:
+        if (cqe.res < 0) {
+          std::cerr << "Failed to poll tty_fd: " << strerror(-cqe.res) << std::endl;
+          received(*entry, nullptr, cqe.res);
+        } else {
+          submit_read(*entry);
+        }
+        break;
+      case OP_WRITE:
+        if (cqe.res == -EAGAIN || cqe.res == -EINTR) {
+          submit(entry, OP_WRITE_POLL, IORING_OP_POLL_ADD, entry->tty_fd, nullptr, 0, POLLOUT);
+        } else if (cqe.res < 0) {
+          write_failed(*entry, -cqe.res);
+        } else {
+          wrote(*entry, cqe.res);
+          flush(*entry);
+        }
+        break;
+      case OP_WRITE_POLL:
+        if (cqe.res < 0) {
+          write_failed(*entry, -cqe.res);
+        } else {
+          flush(*entry);
+        }
+        break;
+      case OP_PID_POLL:
+        if (cqe.res > 0) {
+          entry->session->child_exited();
+        } else {
+          std::cerr << "Failed to poll pidfd: " << strerror(-cqe.res) << std::endl;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  void loop() override {
+    submit_wakeup();
+    // canceled operations of removed sessions complete before the buffers go
+    while (!stop_ || !detached_.empty()) {
+      apply_changes();
+      publish_deferred();
+      if (!deferred_.empty() && !timeout_pending_) {
+        auto timeout = publish_timeout();
+        timeout_.tv_sec = timeout.count() / 1000000000;
+        timeout_.tv_nsec = timeout.count() % 1000000000;
+        submit(nullptr, OP_TIMEOUT, IORING_OP_TIMEOUT, -1, &timeout_, 1);
+        timeout_pending_ = true;
+      }
+      // completions set aside by next_sqe() are not waited for
+      enter(completions_.empty() ? 1 : 0, IORING_ENTER_GETEVENTS);
+
+      reap();
+      // complete() submits, which may reap more
+      for (size_t i = 0; i < completions_.size(); i++) {
+        auto cqe = completions_[i];
+        complete(cqe);
+      }
+      completions_.clear();
+
+      // the kernel reads into the other halves while this batch is parsed, each session parses at most one read
+      //  of this batch, so a flooding session takes turns with the others
+      if (unsubmitted() > 0) {
+        enter(0, 0);
+      }
+      for (auto [entry, data, n] : received_) {
+        service_woken();
+        received(*entry, data, n);
+      }
+      // the next reads are on their way, whether they find more is not known yet
+      for (auto &read : received_) {
+        service(*std::get<0>(read), false);
+      }
+      received_.clear();
+    }
+  }
+
+  int ring_fd_ = -1;
+  void *sq_ring_ = nullptr, *cq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0, cq_ring_size_ = 0, sqes_size_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  std::atomic<uint32_t> *sq_head_, *sq_tail_, *cq_head_, *cq_tail_;
+  uint32_t *sq_array_;
+  uint32_t sq_mask_, sq_entries_, cq_mask_;
+  io_uring_cqe *cqes_;
+  // tail of the queued operations, published to the kernel by enter()
+  uint32_t local_sq_tail_ = 0;
+  uint64_t wakeup_value_;
+
+  // completions taken out of the ring, not processed yet
+  std::vector<io_uring_cqe> completions_;
+  // reads of the current batch
+  std::vector<std::tuple<Entry*, const char*, ssize_t>> received_;
+  // the timeout of publish_deadline_ is in flight
+  bool timeout_pending_ = false;
+  __kernel_timespec timeout_;
+  // removed entries with operations in flight
+  std::unordered_set<Entry*> detached_;
+};
+
+/**
+ * IOReactor
+ */
+IOReactor::IOReactor(int n_workers, bool use_io_uring) {
+  for (int i = 0; i < n_workers; i++) {
+    if (use_io_uring) {
+      auto worker = std::make_unique<UringWorker>();
+      if (worker->setup()) {
+        workers_.push_back(std::move(worker));
+        continue;
+      }
+      // no io_uring, the other workers need not try again
+      use_io_uring = false;
+    }
+    workers_.push_back(std::make_unique<EpollWorker>());
+  }
+  for (auto &worker : workers_) {
+    worker->start();
+  }
+}
+
+IOReactor::~IOReactor() {
+  for (auto &worker : workers_) {
+    worker->stop();
+  }
+}
+
+int IOReactor::add(Session *session, int tty_fd, int pid_fd) {
+  auto least_busy = std::min_element(workers_.begin(), workers_.end(), [](const auto &a, const auto &b) {
+    return a->n_sessions() < b->n_sessions();
+  });
+  (*least_busy)->add(session, tty_fd, pid_fd);
+  return least_busy - workers_.begin();
+}
+
+void IOReactor::remove(int worker, Session *session) {
+  workers_[worker]->remove(session);
+}
+
+void IOReactor::wakeup(int worker, Session *session) {
+  workers_[worker]->wakeup(session);
+}
+
+const char *IOReactor::backend() const {
+  return workers_.front()->backend();
+}
+
+}
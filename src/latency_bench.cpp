@@ -0,0 +1,128 @@
+#include <te/latency_bench.hpp>
+
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_events.h>
+#include <SDL2/SDL_render.h>
+
+namespace te {
+
+LatencyBench::LatencyBench(int n_samples, std::chrono::milliseconds gap)
+    :n_samples_(n_samples), gap_(gap) {
+  // let the child start up before the first key
+  next_key_time_ = clock::now() + std::chrono::milliseconds(500);
+  samples_.reserve(n_samples);
+}
+
+LatencyBench::clock::time_point LatencyBench::next_wakeup() const {
+  if (state_ == State::Idle) {
+    return next_key_time_;
+  } else if (state_ == State::Waiting) {
+    return key_time_ + timeout_;
+  }
+  return clock::time_point::max();
+}
+
+void LatencyBench::push_key(int32_t sym) {
+  SDL_Event event{};
+  event.type = SDL_KEYDOWN;
+  event.key.type = SDL_KEYDOWN;
+  event.key.state = SDL_PRESSED;
+  event.key.keysym.sym = sym;
+  event.key.keysym.mod = KMOD_NONE;
+  if (SDL_PushEvent(&event) < 0) {
+    std::cerr << "Failed to push key event: " << SDL_GetError() << std::endl;
+    abort();
+  }
+}
+
+bool LatencyBench::read_cell(SDL_Renderer *renderer, std::vector<uint32_t> &pixels) const {
+  pixels.resize((size_t) cell_w_ * cell_h_);
+  SDL_Rect rect{cell_x_, cell_y_, cell_w_, cell_h_};
+  if (SDL_RenderReadPixels(renderer, &rect, SDL_PIXELFORMAT_ARGB8888, pixels.data(), cell_w_ * 4) != 0) {
+    std::cerr << "Failed to read back pixels: " << SDL_GetError() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void LatencyBench::on_render(SDL_Renderer *renderer, int x, int y, int w, int h) {
+  auto now = clock::now();
+  if (state_ == State::Idle && now >= next_key_time_) {
+    if (line_length_ >= max_line_length_) {
+      // not measured, the next key is sent after the new line settled
+      push_key(SDLK_RETURN);
+      line_length_ = 0;
+      next_key_time_ = now + gap_;
+      return;
+    }
+    cell_x_ = x;
+    cell_y_ = y;
+    cell_w_ = w;
+    cell_h_ = h;
+    if (!read_cell(renderer, baseline_)) {
+      abort();
+    }
+    push_key('a' + next_char_);
+    next_char_ = (next_char_ + 1) % 26;
+    line_length_++;
+    key_time_ = now;
+    state_ = State::Waiting;
+  } else if (state_ == State::Waiting) {
+    if (read_cell(renderer, pixels_) && pixels_ != baseline_) {
+      state_ = State::Echoed;
+    } else if (now >= key_time_ + timeout_) {
+      timeouts_++;
+      state_ = State::Idle;
+      next_key_time_ = now + gap_;
+    }
+  }
+}
+
+void LatencyBench::on_present(clock::time_point now) {
+  if (state_ == State::Echoed) {
+    samples_.push_back(std::chrono::duration<double, std::milli>(now - key_time_).count());
+    state_ = State::Idle;
+    next_key_time_ = now + gap_;
+  }
+}
+
+void LatencyBench::report(std::ostream &out) const {
+  out << "key-to-screen latency: " << samples_.size() << " samples, " << timeouts_ << " lost" << std::endl;
+  if (samples_.empty()) {
+    return;
+  }
+  auto sorted = samples_;
+  std::sort(sorted.begin(), sorted.end());
+  auto percentile = [&](double q) {
+    return sorted[std::min(sorted.size() - 1, (size_t) (q * sorted.size()))];
+  };
+  double mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+  out << std::fixed << std::setprecision(3)
+      << "  min  " << sorted.front() << " ms" << std::endl
+      << "  mean " << mean << " ms" << std::endl
+      << "  p50  " << percentile(0.5) << " ms" << std::endl
+      << "  p90  " << percentile(0.9) << " ms" << std::endl
+      << "  p99  " << percentile(0.99) << " ms" << std::endl
+      << "  max  " << sorted.back() << " ms" << std::endl;
+
+  // distribution in 1 ms buckets, one '#' per sample up to 60
+  int n_buckets = (int) sorted.back() + 1;
+  std::vector<int> buckets(n_buckets);
+  for (double sample : sorted) {
+    buckets[(int) sample]++;
+  }
+  int max_count = *std::max_element(buckets.begin(), buckets.end());
+  for (int i = 0; i < n_buckets; i++) {
+    if (buckets[i] == 0) {
+      continue;
+    }
+    out << std::setw(5) << i << " ms " << std::setw(6) << buckets[i] << " "
+        << std::string(std::max(1, buckets[i] * 60 / max_count), '#') << std::endl;
+  }
+}
+
+}
@@ -0,0 +1,243 @@
+#include <te/latency_stats.hpp>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <bit>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace te {
+
+int LatencyHistogram::bucket_of(uint64_t ns) {
+  if (ns < sub_buckets) {
+    return (int) ns;
+  }
+  int exponent = 63 - std::countl_zero(ns);
+  int shift = exponent - sub_bucket_bits;
+  // in [sub_buckets, 2 * sub_buckets)
+  int mantissa = (int) (ns >> shift);
+  return (shift + 1) * sub_buckets + (mantissa - sub_buckets);
+}
+
+uint64_t LatencyHistogram::value_of(int bucket) {
+  if (bucket < sub_buckets) {
+    return bucket;
+  }
+  int shift = bucket / sub_buckets - 1;
+  uint64_t low = (uint64_t) (bucket % sub_buckets + sub_buckets) << shift;
+  return low + ((1ull << shift) >> 1u);
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+  buckets_[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(ns, std::memory_order_relaxed);
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (ns > max && !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+  }
+}
+
+double LatencyHistogram::mean() const {
+  uint64_t n = count();
+  return n ? (double) sum_.load(std::memory_order_relaxed) / n : 0;
+}
+
+uint64_t LatencyHistogram::percentile(double q) const {
+  // the buckets may be updated while counting, count them instead of trusting count_
+  uint64_t total = 0;
+  for (auto &bucket : buckets_) {
+    total += bucket.load(std::memory_order_relaxed);
+  }
+  if (total == 0) {
+    return 0;
+  }
+  auto rank = std::max<uint64_t>(1, (uint64_t) (q * total + 0.5));
+  uint64_t seen = 0;
+  for (int i = 0; i < n_buckets; i++) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      return std::min(value_of(i), max());
+    }
+  }
+  return max();
+}
+
+LatencyStats::LatencyStats() {
+  start_time_ = last_time_ = std::chrono::steady_clock::now();
+}
+
+std::string LatencyStats::to_json() {
+  static const char *stage_names[STAGE_COUNT] = {"input", "pty_read", "parse", "apply", "render", "present"};
+
+  std::lock_guard lock(mutex_);
+  auto now = std::chrono::steady_clock::now();
+  uint64_t bytes = bytes_.load(std::memory_order_relaxed), frames = frames_.load(std::memory_order_relaxed);
+  double interval = std::chrono::duration<double>(now - last_time_).count();
+  double uptime = std::chrono::duration<double>(now - start_time_).count();
+
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(3);
+  out << "{\"uptime_s\":" << uptime
+      << ",\"bytes\":" << bytes
+      << ",\"frames\":" << frames
+      << ",\"bytes_per_s\":" << (interval > 0 ? (bytes - last_bytes_) / interval : 0)
+      << ",\"frames_per_s\":" << (interval > 0 ? (frames - last_frames_) / interval : 0)
+      << ",\"stages_us\":{";
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    auto &histogram = histograms_[stage];
+    out << (stage ? "," : "") << "\"" << stage_names[stage] << "\":{"
+        << "\"count\":" << histogram.count()
+        << ",\"mean\":" << histogram.mean() / 1000
+        << ",\"p50\":" << histogram.percentile(0.5) / 1000.0
+        << ",\"p90\":" << histogram.percentile(0.9) / 1000.0
+        << ",\"p99\":" << histogram.percentile(0.99) / 1000.0
+        << ",\"p999\":" << histogram.percentile(0.999) / 1000.0
+        << ",\"max\":" << histogram.max() / 1000.0
+        << "}";
+  }
+  out << "}}\n";
+
+  last_time_ = now;
+  last_bytes_ = bytes;
+  last_frames_ = frames;
+  return out.str();
+}
+
+// the signal handler can only reach the server through this pipe
+static std::atomic<int> signal_pipe_write_fd = -1;
+
+static void on_dump_signal(int) {
+  int saved_errno = errno;
+  int fd = signal_pipe_write_fd.load();
+  if (fd >= 0) {
+    char c = 0;
+    (void) !write(fd, &c, 1);
+  }
+  errno = saved_errno;
+}
+
+LatencyStatsServer::LatencyStatsServer(LatencyStats &stats, std::string socket_path)
+    :stats_(stats), socket_path_(std::move(socket_path)) {
+  if (pipe2(signal_pipe_, O_NONBLOCK | O_CLOEXEC) != 0) {
+    perror("pipe2");
+    abort();
+  }
+  stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (stop_fd_ < 0) {
+    perror("eventfd");
+    abort();
+  }
+  signal_pipe_write_fd = signal_pipe_[1];
+  struct sigaction action{};
+  action.sa_handler = on_dump_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, nullptr);
+
+  if (!socket_path_.empty()) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path_.size() >= sizeof(addr.sun_path)) {
+      std::cerr << "Warning stats socket path too long '" << socket_path_ << "'" << std::endl;
+    } else {
+      strcpy(addr.sun_path, socket_path_.c_str());
+      listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      // a stale socket of a crashed te with the same pid
+      unlink(socket_path_.c_str());
+      if (listen_fd_ < 0 || bind(listen_fd_, (sockaddr*) &addr, sizeof(addr)) != 0 || listen(listen_fd_, 4) != 0) {
+        std::cerr << "Warning failed to listen on stats socket '" << socket_path_ << "': " << strerror(errno)
+                  << std::endl;
+        if (listen_fd_ >= 0) {
+          close(listen_fd_);
+          listen_fd_ = -1;
+        }
+      }
+    }
+  }
+  thread_ = std::thread([this]() { loop(); });
+}
+
+LatencyStatsServer::~LatencyStatsServer() {
+  uint64_t n = 1;
+  if (write(stop_fd_, &n, sizeof(n)) < 0) {
+    perror("write eventfd");
+  }
+  thread_.join();
+  signal(SIGUSR1, SIG_DFL);
+  signal_pipe_write_fd = -1;
+  close(signal_pipe_[0]);
+  close(signal_pipe_[1]);
+  close(stop_fd_);
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(socket_path_.c_str());
+  }
+}
+
+std::string LatencyStatsServer::default_socket_path() {
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  std::string dir = runtime_dir && *runtime_dir ? runtime_dir : "/tmp";
+  return dir + "/te-" + std::to_string(getpid()) + ".stats";
+}
+
+void LatencyStatsServer::write_json(int fd) {
+  auto json = stats_.to_json();
+  size_t written = 0;
+  while (written < json.size()) {
+    ssize_t n = write(fd, json.data() + written, json.size() - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      break;
+    }
+    written += n;
+  }
+}
+
+void LatencyStatsServer::loop() {
+  while (true) {
+    pollfd fds[3] = {
+        {stop_fd_, POLLIN, 0},
+        {signal_pipe_[0], POLLIN, 0},
+        {listen_fd_, POLLIN, 0},
+    };
+    if (poll(fds, listen_fd_ >= 0 ? 3 : 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      return;
+    }
+    if (fds[0].revents & POLLIN) {
+      return;
+    }
+    if (fds[1].revents & POLLIN) {
+      char buffer[64];
+      while (read(signal_pipe_[0], buffer, sizeof(buffer)) > 0) {
+      }
+      write_json(STDERR_FILENO);
+    }
+    if (listen_fd_ >= 0 && (fds[2].revents & POLLIN)) {
+      int client = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client >= 0) {
+        // one dump per connection
+        write_json(client);
+        close(client);
+      }
+    }
+  }
+}
+
+}
@@ -0,0 +1,469 @@
+#include <te/remote.hpp>
+
+#include <cstring>
+
+#include <algorithm>
+#include <iostream>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <te/io_reactor.hpp>
+#include <te/screen.hpp>
+#include <te/session.hpp>
+
+namespace te {
+
+/**
+ * Messages
+ */
+template <typename T>
+static void put(std::string &out, T value) {
+  out.append((const char *) &value, sizeof(value));
+}
+
+static void put_string(std::string &out, std::string_view s) {
+  put<uint32_t>(out, s.size());
+  out.append(s);
+}
+
+// reads a frame, every read after the end of the frame fails
+struct FrameReader {
+  template <typename T>
+  T get() {
+    T value{};
+    if (data.size() - offset < sizeof(T)) {
+      ok = false;
+      return value;
+    }
+    memcpy(&value, data.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return value;
+  }
+
+  std::string_view get_string() {
+    auto size = get<uint32_t>();
+    if (data.size() - offset < size) {
+      ok = false;
+      return {};
+    }
+    auto s = data.substr(offset, size);
+    offset += size;
+    return s;
+  }
+
+  std::string_view data;
+  size_t offset = 0;
+  bool ok = true;
+};
+
+void append_remote_message(std::string &out, RemoteMessage type, std::string_view body) {
+  put<uint32_t>(out, body.size());
+  put<uint8_t>(out, type);
+  out.append(body);
+}
+
+void RemoteMessageReader::feed(const char *data, size_t n) {
+  if (offset_ > 0) {
+    buffer_.erase(0, offset_);
+    offset_ = 0;
+  }
+  buffer_.append(data, n);
+}
+
+bool RemoteMessageReader::next(RemoteMessage &type, std::string_view &body) {
+  constexpr size_t header_size = sizeof(uint32_t) + sizeof(uint8_t);
+  if (corrupt_ || buffer_.size() - offset_ < header_size) {
+    return false;
+  }
+  uint32_t size;
+  memcpy(&size, buffer_.data() + offset_, sizeof(size));
+  if (size > max_message_size) {
+    corrupt_ = true;
+    return false;
+  }
+  if (buffer_.size() - offset_ < header_size + size) {
+    return false;
+  }
+  type = (RemoteMessage) buffer_[offset_ + sizeof(uint32_t)];
+  body = std::string_view(buffer_).substr(offset_ + header_size, size);
+  offset_ += header_size + size;
+  return true;
+}
+
+/**
+ * Frames: the header of the snapshot, the palette if it changed, then the rows that differ from the last frame.
+ * A row is either the index of a row of the last frame, or its cells: only the cells before the blank run are sent.
+ */
+static void put_char(std::string &out, const Char &c) {
+  put<uint32_t>(out, c.fg_color.value);
+  put<uint32_t>(out, c.bg_color.value);
+  put<uint32_t>(out, c.attr.to_ulong());
+  put<uint16_t>(out, std::min(c.c.size(), (size_t) UINT16_MAX));
+  out.append(c.c.data(), std::min(c.c.size(), (size_t) UINT16_MAX));
+}
+
+static Char get_char(FrameReader &in) {
+  Char c;
+  c.fg_color.value = in.get<uint32_t>();
+  c.bg_color.value = in.get<uint32_t>();
+  c.attr = in.get<uint32_t>();
+  auto size = in.get<uint16_t>();
+  if (in.data.size() - in.offset < size) {
+    in.ok = false;
+    return c;
+  }
+  c.c.assign(in.data.substr(in.offset, size));
+  in.offset += size;
+  return c;
+}
+
+// the row of the last frame a row is copied from, none for rows sent with their cells
+constexpr int32_t row_sent_with_cells = -1;
+
+void RemoteFrameEncoder::encode(const ScreenSnapshot &snapshot, std::string &out) {
+  std::string body;
+  put<int32_t>(body, snapshot.max_rows);
+  put<int32_t>(body, snapshot.max_cols);
+  put<int32_t>(body, snapshot.cursor_row);
+  put<int32_t>(body, snapshot.cursor_col);
+  put<uint8_t>(body, snapshot.cursor_show | snapshot.cursor_blink << 1 | snapshot.alternate_screen << 2);
+  put<uint32_t>(body, snapshot.cursor_color.u32);
+  put<uint32_t>(body, snapshot.cursor_fg_color.u32);
+  put<uint32_t>(body, snapshot.attrs.to_ulong());
+  put<int64_t>(body, snapshot.scroll_offset);
+  put<uint64_t>(body, snapshot.buffer_rows);
+  put<uint64_t>(body, snapshot.buffer_bytes);
+  put_string(body, snapshot.window_title);
+
+  bool palette_changed = snapshot.palette->version != palette_version_;
+  put<uint8_t>(body, palette_changed);
+  if (palette_changed) {
+    for (auto color : snapshot.palette->colors) {
+      put<uint32_t>(body, color.u32);
+    }
+    palette_version_ = snapshot.palette->version;
+  }
+
+  // rows of the last frame by version, a scrolled row keeps its version
+  row_index_.clear();
+  for (size_t i = 0; i < row_versions_.size(); i++) {
+    row_index_[row_versions_[i]] = i;
+  }
+  auto n_rows_offset = body.size();
+  put<uint32_t>(body, 0);
+  uint32_t n_rows = 0;
+  for (int i = 0; i < (int) snapshot.rows.size(); i++) {
+    const auto &row = *snapshot.rows[i];
+    if (i < (int) row_versions_.size() && row_versions_[i] == row.version()) {
+      continue;
+    }
+    n_rows++;
+    put<int32_t>(body, i);
+    auto it = row_index_.find(row.version());
+    if (it != row_index_.end()) {
+      put<int32_t>(body, it->second);
+      continue;
+    }
+    put<int32_t>(body, row_sent_with_cells);
+    put<int32_t>(body, row.size());
+    put<int32_t>(body, row.blank_from());
+    put_char(body, row.blank_char());
+    for (int col = 0; col < std::min(row.blank_from(), row.size()); col++) {
+      put_char(body, row[col]);
+    }
+  }
+  memcpy(body.data() + n_rows_offset, &n_rows, sizeof(n_rows));
+
+  row_versions_.resize(snapshot.rows.size());
+  for (size_t i = 0; i < snapshot.rows.size(); i++) {
+    row_versions_[i] = snapshot.rows[i]->version();
+  }
+  sent_version_ = snapshot.version;
+  append_remote_message(out, REMOTE_FRAME, body);
+}
+
+std::shared_ptr<ScreenSnapshot> RemoteFrameDecoder::decode(std::string_view frame) {
+  FrameReader in{frame};
+  auto snapshot = std::make_shared<ScreenSnapshot>();
+  snapshot->max_rows = in.get<int32_t>();
+  snapshot->max_cols = in.get<int32_t>();
+  snapshot->cursor_row = in.get<int32_t>();
+  snapshot->cursor_col = in.get<int32_t>();
+  auto flags = in.get<uint8_t>();
+  snapshot->cursor_show = flags & 1;
+  snapshot->cursor_blink = flags & 2;
+  snapshot->alternate_screen = flags & 4;
+  snapshot->cursor_color.u32 = in.get<uint32_t>();
+  snapshot->cursor_fg_color.u32 = in.get<uint32_t>();
+  snapshot->attrs = in.get<uint32_t>();
+  snapshot->scroll_offset = in.get<int64_t>();
+  snapshot->buffer_rows = in.get<uint64_t>();
+  snapshot->buffer_bytes = in.get<uint64_t>();
+  snapshot->window_title = in.get_string();
+  if (in.get<uint8_t>()) {
+    auto palette = std::make_shared<Palette>();
+    for (auto &color : palette->colors) {
+      color.u32 = in.get<uint32_t>();
+    }
+    palette->version = Palette::next_version();
+    palette_ = std::move(palette);
+  }
+  snapshot->palette = palette_;
+  if (!in.ok || snapshot->max_rows <= 0 || snapshot->max_rows > UINT16_MAX || snapshot->max_cols <= 0) {
+    return nullptr;
+  }
+
+  // rows not in the frame are the rows of the last frame at the same position
+  snapshot->rows = rows_;
+  snapshot->rows.resize(snapshot->max_rows);
+  auto n_rows = in.get<uint32_t>();
+  for (uint32_t i = 0; i < n_rows && in.ok; i++) {
+    auto index = in.get<int32_t>();
+    auto from = in.get<int32_t>();
+    if (index < 0 || index >= snapshot->max_rows) {
+      return nullptr;
+    }
+    if (from != row_sent_with_cells) {
+      if (from < 0 || from >= (int) rows_.size()) {
+        return nullptr;
+      }
+      snapshot->rows[index] = rows_[from];
+      continue;
+    }
+    auto cols = in.get<int32_t>();
+    auto blank_from = in.get<int32_t>();
+    auto blank = get_char(in);
+    if (cols <= 0 || cols > UINT16_MAX || blank_from < 0) {
+      return nullptr;
+    }
+    auto row = std::make_shared<Row>(cols);
+    for (int col = 0; col < std::min(blank_from, cols) && in.ok; col++) {
+      row->at(col) = get_char(in);
+    }
+    row->erase(std::min(blank_from, cols), blank);
+    snapshot->rows[index] = std::move(row);
+  }
+  if (!in.ok || std::find(snapshot->rows.begin(), snapshot->rows.end(), nullptr) != snapshot->rows.end()) {
+    return nullptr;
+  }
+  rows_ = snapshot->rows;
+  return snapshot;
+}
+
+/**
+ * RemoteServer
+ */
+RemoteServer::RemoteServer(std::ostream &log_stream,
+                           const std::vector<std::string> &args,
+                           const std::string &term_env,
+                           const std::vector<std::string> &environment_variables,
+                           std::string socket_path,
+                           bool verbose_log)
+    : socket_path_(std::move(socket_path)) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (socket_path_.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Server socket path too long '" << socket_path_ << "'" << std::endl;
+    exit(1);
+  }
+  strcpy(addr.sun_path, socket_path_.c_str());
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    perror("socket");
+    abort();
+  }
+  // a socket nobody answers on is left over by a server that crashed
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  bool in_use = probe >= 0 && connect(probe, (sockaddr *) &addr, sizeof(addr)) == 0;
+  if (probe >= 0) {
+    close(probe);
+  }
+  if (in_use) {
+    std::cerr << "A server is already listening on '" << socket_path_ << "'" << std::endl;
+    exit(1);
+  }
+  unlink(socket_path_.c_str());
+  // whoever can connect can type into the session
+  auto old_umask = umask(0077);
+  int ret = bind(listen_fd_, (sockaddr *) &addr, sizeof(addr));
+  umask(old_umask);
+  if (ret != 0 || listen(listen_fd_, 16) != 0) {
+    std::cerr << "Failed to listen on '" << socket_path_ << "': " << strerror(errno) << std::endl;
+    exit(1);
+  }
+
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeup_fd_ < 0) {
+    perror("eventfd");
+    abort();
+  }
+
+  std::vector<std::string> envs;
+  for (const auto &env : environment_variables) {
+    if (env.starts_with("TERM=")) {
+      envs.emplace_back("TERM=" + term_env);
+    } else {
+      envs.emplace_back(env);
+    }
+  }
+  // sized by the first client, nothing is published until one attaches
+  reactor_ = std::make_unique<IOReactor>(1);
+  session_ = std::make_unique<Session>(nullptr, *reactor_, log_stream, stats_, args, envs, 24, 80, 0, 0, verbose_log, this);
+  session_->set_visible(false);
+}
+
+RemoteServer::~RemoteServer() {
+  session_.reset();
+  reactor_.reset();
+  for (auto &client : clients_) {
+    close(client->fd);
+  }
+  close(wakeup_fd_);
+  close(listen_fd_);
+  unlink(socket_path_.c_str());
+}
+
+void RemoteServer::wakeup() const {
+  uint64_t n = 1;
+  if (write(wakeup_fd_, &n, sizeof(n)) < 0) {
+    perror("write eventfd");
+  }
+}
+
+bool RemoteServer::read_client(Client &client) {
+  char buffer[16 * 1024];
+  while (true) {
+    ssize_t n = read(client.fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    client.reader.feed(buffer, n);
+    RemoteMessage type;
+    std::string_view body;
+    while (client.reader.next(type, body)) {
+      if (type == REMOTE_INPUT) {
+        session_->write_to_tty(body);
+      } else if (type == REMOTE_PASTE) {
+        session_->queue_paste(body);
+      } else if (type == REMOTE_RESIZE && body.size() == 2 * sizeof(int32_t)) {
+        // the session takes the size of the client that resized last
+        int32_t size[2];
+        memcpy(size, body.data(), sizeof(size));
+        if (size[0] > 0 && size[1] > 0) {
+          session_->resize(size[0], size[1]);
+        }
+      }
+    }
+    if (client.reader.corrupt()) {
+      return false;
+    }
+  }
+}
+
+bool RemoteServer::flush_client(Client &client) {
+  while (client.output_offset < client.output.size()) {
+    ssize_t n = write(client.fd, client.output.data() + client.output_offset,
+                      client.output.size() - client.output_offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    if (n < 0) {
+      return false;
+    }
+    client.output_offset += n;
+  }
+  client.output.clear();
+  client.output_offset = 0;
+  return true;
+}
+
+void RemoteServer::loop() {
+  std::vector<pollfd> fds;
+  while (!session_->exited()) {
+    fds.clear();
+    fds.push_back({wakeup_fd_, POLLIN, 0});
+    fds.push_back({listen_fd_, POLLIN, 0});
+    for (auto &client : clients_) {
+      fds.push_back({client->fd, (short) (POLLIN | (client->output.empty() ? 0 : POLLOUT)), 0});
+    }
+    // without a pidfd the exit of the child is polled
+    int timeout = session_->subprocess_->pid_fd() < 0 ? 100 : -1;
+    if (poll(fds.data(), fds.size(), timeout) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      abort();
+    }
+    if (fds[0].revents & POLLIN) {
+      uint64_t n;
+      if (read(wakeup_fd_, &n, sizeof(n)) < 0) {
+        perror("read eventfd");
+      }
+    }
+
+    for (size_t i = 0; i < clients_.size(); i++) {
+      auto &client = *clients_[i];
+      auto revents = fds[i + 2].revents;
+      bool alive = true;
+      if (revents & POLLIN) {
+        alive = read_client(client);
+      } else if (revents & (POLLHUP | POLLERR)) {
+        alive = false;
+      }
+      if (alive && (revents & POLLOUT)) {
+        alive = flush_client(client);
+      }
+      if (!alive) {
+        close(client.fd);
+        client.fd = -1;
+      }
+    }
+    std::erase_if(clients_, [](const auto &client) { return client->fd < 0; });
+
+    if (fds[1].revents & POLLIN) {
+      int fd;
+      while ((fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        auto client = std::make_unique<Client>();
+        client->fd = fd;
+        clients_.push_back(std::move(client));
+      }
+    }
+    // snapshots are only published while somebody watches
+    session_->set_visible(!clients_.empty());
+
+    // a client gets the latest snapshot once it has taken the previous frame
+    auto snapshot = session_->snapshot();
+    for (auto &client : clients_) {
+      if (client->output.empty() && client->encoder.sent_version() != snapshot->version) {
+        client->encoder.encode(*snapshot, client->output);
+        if (!flush_client(*client)) {
+          close(client->fd);
+          client->fd = -1;
+        }
+      }
+    }
+    std::erase_if(clients_, [](const auto &client) { return client->fd < 0; });
+  }
+  // the clients see the hangup and close their panes
+  for (auto &client : clients_) {
+    close(client->fd);
+  }
+  clients_.clear();
+}
+
+}
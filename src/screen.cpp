@@ -1,7 +1,9 @@
 #include <te/screen.hpp>
 
 #include <cassert>
+#include <cctype>
 
+#include <array>
 #include <chrono>
 #include <functional>
 #include <iostream>
@@ -10,12 +12,12 @@
 #include <unordered_set>
 #include <vector>
 
-#include <te/display.hpp>
+#include <te/session.hpp>
 #include "csi_helper.hpp"
 
 namespace te {
-Screen::Screen(Display *display) :display_(display) {
-  resize(display_->max_rows_, display_->max_cols_);
+Screen::Screen(Session *session, bool scrollback) :session_(session), scrollback_(scrollback) {
+  resize(session_->max_rows_, session_->max_cols_);
   normal_mode();
 }
 
@@ -124,7 +126,8 @@ bool Screen::process_csi(const std::string &seq) {
         clear_screen(0, 0, cursor_row, cursor_col);
         return true;
       } else if (code == 2) {
-        clear_screen(0, 0, cursor_row, cursor_col - 1);
+        // entire screen
+        clear_screen(0, 0, max_rows_ - 1, max_cols_ - 1);
         return true;
       } else {
         std::cerr << "Invalid clear screen code " << code << std::endl;
@@ -162,38 +165,35 @@ bool Screen::process_csi(const std::string &seq) {
     } else if (op == 'S' || op == 'T') {
       // scroll
       auto [code] = csi_n<1>(seq, 1);
+      if (!scrollback_) {
+        if (op == 'S') {
+          scroll_up(code);
+        } else {
+          scroll_down(code);
+        }
+        return true;
+      }
       int scroll_diff = ((op == 'S') ? -1 : 1) * code;
+      int old_start_row = current_screen_start_row;
       if (current_screen_start_row + scroll_diff < 0) {
         current_screen_start_row = 0;
       } else if (current_screen_start_row + scroll_diff + max_rows_ > rows_.size()) {
-        auto new_lines = rows_.size() - (current_screen_start_row + scroll_diff + max_rows_);
+        int new_lines = current_screen_start_row + scroll_diff + max_rows_ - (int) rows_.size();
         for (int i = 0; i < new_lines; i++) {
-          rows_.emplace_back(max_cols_);
+          rows_.push_back(std::make_shared<Row>(max_cols_));
         }
 
         current_screen_start_row += scroll_diff;
       } else {
         current_screen_start_row += scroll_diff;
       }
+      scroll_offset += current_screen_start_row - old_start_row;
       return true;
 
     } else if (op == 'X') {
-      // erase n chars from current
+      // erase n chars from current, ECH does not wrap to the next line
       auto [n] = csi_n<1>(seq, 1);
-      int row = cursor_row;
-      int col = cursor_col;
-      int count = n;
-      while (count > 0) {
-        get_row(row)[col].reset();
-        count--;
-        col++;
-        if (col == max_cols_) {
-          row++;
-        }
-        if (row == max_cols_) {
-          break;
-        }
-      }
+      clear_screen(cursor_row, cursor_col, cursor_row, std::min(cursor_col + std::max(n, 1) - 1, max_cols_ - 1));
       return true;
 
     } else if (op == 'c') {
@@ -232,14 +232,14 @@ bool Screen::process_csi(const std::string &seq) {
           std::stringstream ss;
           // VT100 xterm95
           ss << CSI << ">0;95;0c";
-          display_->write_to_tty(ss.str());
+          session_->write_to_tty(ss.str());
           return true;
         }
 
       } else {
         auto [code] = csi_n<1>(seq, 0);
         // CSI ? 1 ; 2 c
-        display_->write_to_tty("\x1b[?1;2c");
+        session_->write_to_tty("\x1b[?1;2c");
         return true;
       }
     } else if (op == 'd') {
@@ -299,11 +299,18 @@ bool Screen::process_csi(const std::string &seq) {
             case 1004:current_attrs.set(CHAR_ATTR_XTERM_WINDOW_FOCUS_TRACKING, enable);
               break;
             case 47:
+              // switch to alternate buffer
+              session_->switch_screen(enable, false, false);
+              break;
+            case 1047:
+              // switch to alternate buffer, clear it when leaving
+              session_->switch_screen(enable, false, !enable);
+              break;
             case 1049:
-              // switch to alternate buffer and save cursor
+              // save cursor and switch to a cleared alternate buffer, restore cursor when leaving
               // https://invisible-island.net/xterm/xterm.log.html#xterm_90
               // https://gitlab.gnome.org/GNOME/vte/-/blob/master/src/vteseq.cc#L527
-              display_->switch_screen(enable);
+              session_->switch_screen(enable, true, enable);
               break;
             case 2004:
               // When you are in bracketed paste mode and you paste into your terminal the content will be wrapped by the sequences \e[200~ and  \e[201~.
@@ -366,71 +373,7 @@ bool Screen::process_csi(const std::string &seq) {
         // Set/reset key modifier options (XTMODKEYS), xterm
         return true;
       } else {
-        // set attributes
-        auto ints = parse_csi_colon_ints(seq, 0, seq.size() - 1);
-        if (ints.size() == 3) {
-          // 256 colors
-          if (ints[0] == 38 && ints[1] == 5) {
-            // set foreground color
-            current_fg_color = ColorTable256[ints[2]];
-            return true;
-          } else if (ints[0] == 48 && ints[1] == 5) {
-            current_bg_color = ColorTable256[ints[2]];
-            return true;
-          }
-        }
-
-        bool found_unknown = false;
-        for (auto i : ints) {
-          switch (i) {
-            case 0:
-              //            std::cout << "CSI reset attributes" << std::endl;
-              current_fg_color = get_default_fg_color();
-              current_bg_color = get_default_bg_color();
-              current_attrs.reset();
-              break;
-            case 1: // bold
-              current_attrs.set(CHAR_ATTR_BOLD);
-              break;
-            case 2: // faint
-              current_attrs.set(CHAR_ATTR_FAINT);
-              break;
-            case 3: // italic
-              current_attrs.set(CHAR_ATTR_ITALIC);
-              break;
-            case 4:current_attrs.set(CHAR_ATTR_UNDERLINE);
-              break;
-            case 7:current_attrs.set(CHAR_ATTR_INVERT);
-              break;
-            case 9:current_attrs.set(CHAR_ATTR_CROSSED_OUT);
-              break;
-            case 27:current_attrs.reset(CHAR_ATTR_INVERT);
-              break;
-            case 29:current_attrs.reset(CHAR_ATTR_CROSSED_OUT);
-              break;
-            case 39:current_fg_color = get_default_fg_color();
-              break;
-            case 49:current_bg_color = get_default_bg_color();
-              break;
-            default:
-              if (30 <= i && i < 38) {
-                current_fg_color = ColorTable16[i - 30];
-                //              std::cout << "CSI set fg color" << std::endl;
-              } else if (40 <= i && i < 48) {
-                current_bg_color = ColorTable16[i - 30];
-                //              std::cout << "CSI set bg color" << std::endl;
-              } else if (90 <= i && i < 98) {
-                current_fg_color = ColorTable16[i - 90 + 8];
-              } else if (100 <= i && i < 108) {
-                current_fg_color = ColorTable16[i - 100 + 8];
-
-              } else {
-                found_unknown = true;
-              }
-          }
-        }
-        return !found_unknown;
-
+        return process_sgr(seq.substr(0, seq.size() - 1));
       }
     } else if (op == 'n') {
       auto ints = parse_csi_colon_ints(seq, 0, seq.size() - 1);
@@ -442,7 +385,7 @@ bool Screen::process_csi(const std::string &seq) {
           std::stringstream ss;
           ss << ESC << '[' << (cursor_row + 1) << ';' << (cursor_col + 1) << 'R';
           auto s = ss.str();
-          display_->write_to_tty(s);
+          session_->write_to_tty(s);
           return true;
         }
       }
@@ -462,16 +405,16 @@ bool Screen::process_csi(const std::string &seq) {
         return true;
       } else if (ints == std::vector<int>{22, 2}) {
         // push xterm window title on stack
-        display_->xterm_title_stack_.push_back(display_->window_title_);
+        session_->xterm_title_stack_.push_back(session_->window_title_);
         return true;
       } else if (ints == std::vector<int>{23, 1}) {
         // pop xterm icon title from stack
         return true;
       } else if (ints == std::vector<int>{23, 2}) {
         // push xterm window title on stack
-        if (!display_->xterm_title_stack_.empty()) {
-          display_->window_title_ = display_->xterm_title_stack_.back();
-          display_->xterm_title_stack_.pop_back();
+        if (!session_->xterm_title_stack_.empty()) {
+          session_->window_title_ = session_->xterm_title_stack_.back();
+          session_->xterm_title_stack_.pop_back();
         } else {
           std::cerr << "Warning, title stack empty" << std::endl;
         }
@@ -485,5 +428,130 @@ bool Screen::process_csi(const std::string &seq) {
   }
 }
 
+// SGR parameters are separated by ';', sub-parameters of the extended colors by ':' (ITU T.416),
+//  e.g. "1;38;5;208;48:2::10:20:30". Empty parameters are 0.
+bool Screen::process_sgr(const std::string &seq) {
+  constexpr int max_params = 32;
+  std::array<int, max_params> values{};
+  // values[i] is a ':' sub-parameter of values[i - 1]
+  std::array<bool, max_params> is_sub{};
+  int n = 0;
+  is_sub[0] = false;
+  for (char c : seq) {
+    if (std::isdigit(c)) {
+      values[n] = std::min(values[n] * 10 + (c - '0'), 0xffffff);
+    } else if ((c == ';' || c == ':') && n + 1 < max_params) {
+      n++;
+      is_sub[n] = c == ':';
+    }
+  }
+  n++;
+
+  // sub-parameters following values[i]
+  auto n_subs = [&](int i) {
+    int count = 0;
+    while (i + 1 + count < n && is_sub[i + 1 + count]) {
+      count++;
+    }
+    return count;
+  };
+  // 38/48 color starting at values[i], returns the parameters used
+  auto parse_extended_color = [&](int i, CellColor &color) {
+    int subs = n_subs(i);
+    bool colon = subs > 0;
+    int available = colon ? subs : n - i - 1;
+    if (available >= 2 && values[i + 1] == 5) {
+      color = CellColor::indexed(std::min(values[i + 2], 255));
+      return colon ? subs + 1 : 3;
+    } else if (available >= 4 && values[i + 1] == 2) {
+      // the colon form may carry a color space id before r:g:b
+      int first = colon && subs >= 5 ? i + 3 : i + 2;
+      color = CellColor::rgb(std::min(values[first], 255), std::min(values[first + 1], 255),
+                             std::min(values[first + 2], 255));
+      return colon ? subs + 1 : 5;
+    }
+    // malformed, skip what belongs to it
+    return colon ? subs + 1 : n - i;
+  };
+
+  bool found_unknown = false;
+  for (int i = 0; i < n;) {
+    int p = values[i];
+    switch (p) {
+      case 0:
+        current_fg_color = get_default_fg_color();
+        current_bg_color = get_default_bg_color();
+        current_attrs &= ~std::bitset<CHAR_ATTR_COUNT>(CharAttrSGRMask);
+        break;
+      case 1:current_attrs.set(CHAR_ATTR_BOLD);
+        break;
+      case 2:current_attrs.set(CHAR_ATTR_FAINT);
+        break;
+      case 3:current_attrs.set(CHAR_ATTR_ITALIC);
+        break;
+      case 4:
+        // 4:0 is no underline, 4:1 to 4:5 are underline styles
+        current_attrs.set(CHAR_ATTR_UNDERLINE, !(n_subs(i) > 0 && values[i + 1] == 0));
+        break;
+      case 5:
+      case 6:
+        // blinking text is not supported
+        break;
+      case 7:current_attrs.set(CHAR_ATTR_INVERT);
+        break;
+      case 9:current_attrs.set(CHAR_ATTR_CROSSED_OUT);
+        break;
+      case 21:current_attrs.set(CHAR_ATTR_UNDERLINE);
+        break;
+      case 22:
+        current_attrs.reset(CHAR_ATTR_BOLD);
+        current_attrs.reset(CHAR_ATTR_FAINT);
+        break;
+      case 23:current_attrs.reset(CHAR_ATTR_ITALIC);
+        break;
+      case 24:current_attrs.reset(CHAR_ATTR_UNDERLINE);
+        break;
+      case 25:
+        break;
+      case 27:current_attrs.reset(CHAR_ATTR_INVERT);
+        break;
+      case 29:current_attrs.reset(CHAR_ATTR_CROSSED_OUT);
+        break;
+      case 38:
+        i += parse_extended_color(i, current_fg_color);
+        continue;
+      case 39:current_fg_color = get_default_fg_color();
+        break;
+      case 48:
+        i += parse_extended_color(i, current_bg_color);
+        continue;
+      case 49:current_bg_color = get_default_bg_color();
+        break;
+      case 58: {
+        // underline color is not supported
+        CellColor ignored{};
+        i += parse_extended_color(i, ignored);
+        continue;
+      }
+      case 59:
+        break;
+      default:
+        if (30 <= p && p < 38) {
+          current_fg_color = CellColor::indexed(p - 30);
+        } else if (40 <= p && p < 48) {
+          current_bg_color = CellColor::indexed(p - 40);
+        } else if (90 <= p && p < 98) {
+          current_fg_color = CellColor::indexed(p - 90 + 8);
+        } else if (100 <= p && p < 108) {
+          current_bg_color = CellColor::indexed(p - 100 + 8);
+        } else {
+          found_unknown = true;
+        }
+    }
+    // unknown sub-parameters are skipped with their parameter
+    i += 1 + n_subs(i);
+  }
+  return !found_unknown;
+}
 
 }
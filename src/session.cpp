@@ -0,0 +1,756 @@
+#include <te/session.hpp>
+
+#include <cmath>
+#include <cstring>
+
+#include <algorithm>
+#include <charconv>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <te/display.hpp>
+#include <te/screen.hpp>
+#include <te/unicode.hpp>
+
+namespace te {
+void set_tty_window_size(int tty_fd, int cols, int rows, int res_w, int res_h) {
+  winsize screen_size;
+  screen_size.ws_col = cols;
+  screen_size.ws_row = rows;
+  screen_size.ws_xpixel = res_w;
+  screen_size.ws_ypixel = res_h;
+
+  if (ioctl(tty_fd, TIOCSWINSZ, &screen_size) < 0) {
+    perror("ioctl TIOCSWINSZ");
+    abort();
+  }
+}
+
+Session::Session(Display *display,
+                 IOReactor &reactor,
+                 std::ostream &log_stream,
+                 LatencyStats &stats,
+                 const std::vector<std::string> &args,
+                 const std::vector<std::string> &envs,
+                 int rows,
+                 int cols,
+                 int glyph_width,
+                 int glyph_height,
+                 bool verbose_log,
+                 RemoteServer *server)
+    : display_(display), server_(server), reactor_(reactor), max_rows_(rows), max_cols_(cols), glyph_width_(glyph_width), glyph_height_(glyph_height),
+      stats_(stats), log_stream_(log_stream), verbose_log_(verbose_log) {
+  /**
+   * Initialize subprocess
+   */
+  subprocess_ = std::make_unique<Subprocess>(args[0], args, envs);
+  set_tty_window_size(subprocess_->tty_fd(), cols, rows, cols * glyph_width_, rows * glyph_height_);
+
+  /**
+   * Initialize multiple screens
+   */
+  default_screen_ = std::make_unique<Screen>(this, true);
+  alternate_screen_ = std::make_unique<Screen>(this, false);
+  current_screen_ = default_screen_.get();
+
+  /**
+   * Hand the tty and the child to the reactor, the screens belong to its worker from now on
+   */
+  publish_snapshot();
+  reactor_worker_ = reactor_.add(this, subprocess_->tty_fd(), subprocess_->pid_fd());
+}
+
+Session::Session(Display *display,
+                 IOReactor &reactor,
+                 std::ostream &log_stream,
+                 LatencyStats &stats,
+                 const std::string &server_socket_path,
+                 int rows,
+                 int cols)
+    : display_(display), reactor_(reactor), max_rows_(rows), max_cols_(cols), glyph_width_(0), glyph_height_(0),
+      stats_(stats), log_stream_(log_stream) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (server_socket_path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Server socket path too long '" << server_socket_path << "'" << std::endl;
+    exit(1);
+  }
+  strcpy(addr.sun_path, server_socket_path.c_str());
+  remote_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (remote_fd_ < 0 || connect(remote_fd_, (sockaddr *) &addr, sizeof(addr)) != 0) {
+    std::cerr << "Failed to attach to '" << server_socket_path << "': " << strerror(errno) << std::endl;
+    exit(1);
+  }
+  fcntl(remote_fd_, F_SETFL, fcntl(remote_fd_, F_GETFL) | O_NONBLOCK);
+
+  // blank until the first frame of the server arrives
+  auto snapshot = std::make_shared<ScreenSnapshot>();
+  snapshot->rows.assign(rows, std::make_shared<const Row>(cols));
+  snapshot->max_rows = rows;
+  snapshot->max_cols = cols;
+  snapshot->palette = palette_;
+  snapshot->version = ++snapshot_version_;
+  snapshot_.store(std::move(snapshot));
+
+  reactor_worker_ = reactor_.add(this, remote_fd_, -1);
+  resize(rows, cols);
+}
+
+Session::~Session() {
+  reactor_.remove(reactor_worker_, this);
+  if (remote_fd_ >= 0) {
+    close(remote_fd_);
+  }
+}
+
+void Session::write_pending_input_data(std::vector<uint8_t> &input_buffer) {
+  if (!input_buffer.empty()) {
+    write_to_tty(std::string_view((const char *) input_buffer.data(), input_buffer.size()));
+    input_buffer.clear();
+  }
+}
+
+void hexdump(std::ostream &os, std::span<const char> data) {
+  int width = 16;
+  std::stringstream ss_hex, ss_s;
+  int addr_width = ceil(log2(data.size()) / 4);
+  os << "0x" << std::hex << std::setw(addr_width) << std::setfill('0') << 0 << " ";
+  for (size_t i = 0; i < data.size(); i++) {
+    ss_hex << std::hex << std::setw(2) << std::setfill('0') << (int)(uint8_t) data[i] << ' ';
+    if (std::isprint(data[i])) {
+      ss_s << data[i];
+    } else {
+      ss_s << '.';
+    }
+
+    if (i % width == width - 1) {
+      os << ss_hex.str() << " | " << ss_s.str() << std::endl;
+      os << "0x" << std::hex << std::setw(addr_width) << std::setfill('0') << i << " ";
+      ss_hex.str("");
+      ss_hex.clear();
+      ss_s.str("");
+      ss_s.clear();
+    }
+  }
+
+  auto rest = data.size() % width;
+  if (rest > 0) {
+    os << ss_hex.str();
+    for (int i = 0; i < width - rest; i++) {
+      os << "   ";
+    }
+    os << " | " << ss_s.str();
+    for (int i = 0; i < width - rest; i++) {
+      os << '.';
+    }
+    os << std::endl;
+  }
+}
+
+constexpr const char* escape_table[] = {
+    "\\0",0,0,0,  0,0,0,"\\a", "\\b","\\t","\\n","\\v", "\\f","\\r",0,0,
+};
+
+// reactor worker: parse n bytes read from the tty
+void Session::receive(const char *input_buffer, size_t nread) {
+  if (remote()) {
+    receive_remote(input_buffer, nread);
+    return;
+  }
+  bool verbose_read = verbose_log_;
+  bool has_color = true;
+
+  auto t_parse = std::chrono::high_resolution_clock::now();
+  stats_.add_bytes(nread);
+  rate_window_bytes_ += nread;
+  for (size_t i = 0; i < nread; i++) {
+    if (tty_input_.accepts_text()) {
+      // text up to the next control character, decoded in bulk
+      size_t n = tty_input_.decode_text(input_buffer + i, nread - i, decoded_text_);
+      if (verbose_read) {
+        log_stream_.write(input_buffer + i, n);
+      }
+      for (uint32_t codepoint : decoded_text_) {
+        got_character(codepoint);
+      }
+      i += n;
+      if (i == nread) {
+        break;
+      }
+    }
+    uint32_t c = (uint8_t)input_buffer[i];
+    auto input_type = tty_input_.receive_char(input_buffer[i]);
+
+    if (input_type == TTYInputType::Char) {
+      if (verbose_read) {
+        log_verbose_input_char(c, has_color);
+      }
+      if (c == '\n' || c == '\f') {
+        // https://invisible-island.net/xterm/ctlseqs/ctlseqs.html
+        //  Form Feed or New Page (NP ).  (FF  is Ctrl-L).  FF  is treated the same as LF.
+        current_screen_->new_line();
+      } else if (c == 0x0f) {
+        // switch to standard char set
+      } else if (c == '\r') {
+        // carriage return
+        current_screen_->cursor_col = 0;
+      } else if (c == '\a') {
+//        std::cout << "alarm" << std::endl;
+      } else if (c == '\b') {
+//        std::cout << "back space" << std::endl;
+        if (current_screen_->cursor_col == 0) {
+          if (current_screen_->cursor_row == 0) {
+            // nothing
+          } else {
+            current_screen_->cursor_col = current_screen_->max_cols_ - 1;
+            current_screen_->cursor_row--;
+          }
+        } else {
+          current_screen_->cursor_col--;
+        }
+      } else if (c == 0x0f || c == 0x0e) {
+        if (c == 0x0f) {
+          // select G0 character set
+        } else {
+          std::cerr << "Warning, we do not support G1 character set";
+        }
+      } else if (c < 0x20) {
+        // ignore unknown control characters
+      } else {
+        got_character(c);
+      }
+    } else if (input_type == TTYInputType::CSI) {
+      auto ok = current_screen_->process_csi(tty_input_.buffer_);
+      if (!ok) {
+        std::cout << "unknown csi seq ESC [ ";
+        for (auto c : tty_input_.buffer_) {
+          std::cout << c;
+        }
+        std::cout << std::endl;
+        hexdump(std::cout, tty_input_.buffer_);
+      } else {
+        if (verbose_read) {
+          std::cout << "csi seq ESC [ ";
+          for (auto c : tty_input_.buffer_) {
+            std::cout << c;
+          }
+          std::cout << std::endl;
+          hexdump(std::cout, tty_input_.buffer_);
+
+        }
+      }
+      if (verbose_read) {
+        if (has_color) {
+          log_stream_ << "\x1b[33m{\x1b[32m";
+        } else {
+          log_stream_ << "{";
+        }
+        log_stream_ << "CSI ";
+        log_stream_.write((const char*)tty_input_.buffer_.data(), tty_input_.buffer_.size());
+        if (has_color) {
+          log_stream_ << "\x1b[33m}\x1b[0m";
+        } else {
+          log_stream_ << "}";
+        }
+        log_stream_.flush();
+      }
+    } else if (input_type == TTYInputType::TerminatedByST) {
+      if (verbose_read) {
+        std::cout << "TerminatedByST: " << std::endl;
+        hexdump(std::cout, tty_input_.buffer_);
+
+        if (has_color) {
+          log_stream_ << "\x1b[33m{\x1b[32m";
+        } else {
+          log_stream_ << "{";
+        }
+        log_stream_ << "ESC ";
+        log_stream_.write((const char*)tty_input_.buffer_.data(), tty_input_.buffer_.size());
+        if (has_color) {
+          log_stream_ << "\x1b[33m}\x1b[0m";
+        } else {
+          log_stream_ << "}";
+        }
+        log_stream_.flush();
+      }
+      const auto &b = tty_input_.buffer_;
+      if (!b.empty()) {
+        if (b[0] == ']') {
+          // OSC: Operating System Control
+          process_osc(std::string_view(reinterpret_cast<const char *>(b.data() + 1), b.size() - 1));
+        }
+      }
+    } else if (input_type == TTYInputType::UTF8) {
+      if (verbose_read) {
+        if (has_color) {
+          log_stream_ << "\x1b[33m{\x1b[32m";
+        } else {
+          log_stream_ << "{";
+        }
+        log_stream_ << "u ";
+        for (auto n : tty_input_.buffer_) {
+          log_stream_ << "\\x" << std::hex << std::setfill('0') << std::setw(2) << (uint32_t)(uint8_t)n;
+        }
+        if (has_color) {
+          log_stream_ << "\x1b[33m}\x1b[0m";
+        } else {
+          log_stream_ << "}";
+        }
+        log_stream_.flush();
+      }
+
+      got_character(utf8_decode(tty_input_.buffer_));
+
+    }
+  }
+  stats_.record(LatencyStats::STAGE_PARSE, std::chrono::high_resolution_clock::now() - t_parse);
+  snapshot_stale_ = true;
+}
+
+// X11 color spec of OSC 4, 10 and 11: rgb:r/g/b with 1 to 4 hex digits per channel, #rgb or #rrggbb
+static std::optional<Color> parse_color_spec(std::string_view spec) {
+  auto parse_hex = [](std::string_view s, int &value) {
+    if (s.empty() || s.size() > 4) {
+      return false;
+    }
+    value = 0;
+    for (char c : s) {
+      if (!std::isxdigit(c)) {
+        return false;
+      }
+      value = value * 16 + (std::isdigit(c) ? c - '0' : std::tolower(c) - 'a' + 10);
+    }
+    // scale to 8 bits, 'f', 'ff', 'fff' and 'ffff' are all 0xff
+    value = value * 255 / ((1 << (4 * s.size())) - 1);
+    return true;
+  };
+
+  int channels[3];
+  if (spec.starts_with("rgb:")) {
+    spec.remove_prefix(4);
+    for (int i = 0; i < 3; i++) {
+      auto end = spec.find('/');
+      if ((i < 2) != (end != std::string_view::npos) || !parse_hex(spec.substr(0, end), channels[i])) {
+        return std::nullopt;
+      }
+      spec.remove_prefix(i < 2 ? end + 1 : spec.size());
+    }
+  } else if (spec.starts_with("#") && (spec.size() == 4 || spec.size() == 7)) {
+    int digits = (spec.size() - 1) / 3;
+    for (int i = 0; i < 3; i++) {
+      if (!parse_hex(spec.substr(1 + i * digits, digits), channels[i])) {
+        return std::nullopt;
+      }
+    }
+  } else {
+    return std::nullopt;
+  }
+  Color color{};
+  color.r = channels[0];
+  color.g = channels[1];
+  color.b = channels[2];
+  color.a = 0xff;
+  return color;
+}
+
+// reply to a color query: ESC ] command ; [index ;] rgb:rrrr/gggg/bbbb ST
+static std::string format_color_reply(const std::string &prefix, Color color) {
+  std::ostringstream ss;
+  ss << "\x1b]" << prefix << "rgb:" << std::hex << std::setfill('0')
+     << std::setw(4) << color.r * 0x101 << "/"
+     << std::setw(4) << color.g * 0x101 << "/"
+     << std::setw(4) << color.b * 0x101 << "\x1b\\";
+  return ss.str();
+}
+
+// OSC without the leading ']' and the terminator
+void Session::process_osc(std::string_view osc) {
+  auto separator = osc.find(';');
+  auto command = osc.substr(0, separator);
+  std::vector<std::string_view> args;
+  if (separator != std::string_view::npos) {
+    auto rest = osc.substr(separator + 1);
+    while (true) {
+      auto end = rest.find(';');
+      args.push_back(rest.substr(0, end));
+      if (end == std::string_view::npos) {
+        break;
+      }
+      rest.remove_prefix(end + 1);
+    }
+  }
+
+  // the palette is shared with published snapshots, copy it once per OSC
+  std::shared_ptr<Palette> palette;
+  auto writable_palette = [&]() -> Palette & {
+    if (!palette) {
+      palette = std::make_shared<Palette>(*palette_);
+      palette->version = Palette::next_version();
+    }
+    return *palette;
+  };
+  static const Palette default_palette = Palette::default_palette();
+  auto reset_color = [&](int index) {
+    writable_palette().colors[index] = default_palette.colors[index];
+  };
+  auto set_or_query = [&](int index, std::string_view spec, const std::string &reply_prefix) {
+    if (spec == "?") {
+      write_to_tty(format_color_reply(reply_prefix, palette ? palette->colors[index] : palette_->colors[index]));
+    } else if (auto color = parse_color_spec(spec)) {
+      writable_palette().colors[index] = *color;
+    }
+  };
+
+  if (command == "0") {
+    // set title
+    // the render thread sets the SDL window title from the next snapshot
+    window_title_ = std::string(osc.substr(std::min(osc.size(), command.size() + 1)));
+  } else if (command == "4") {
+    // ESC ] 4 ; index ; spec [; index ; spec ...] ST, set or query palette colors
+    for (size_t i = 0; i + 1 < args.size(); i += 2) {
+      int index = -1;
+      std::from_chars(args[i].data(), args[i].data() + args[i].size(), index);
+      if (0 <= index && index < 256) {
+        set_or_query(index, args[i + 1], "4;" + std::to_string(index) + ";");
+      }
+    }
+  } else if (command == "10" || command == "11") {
+    // ESC ] 10 ; fg [; bg] ST, following arguments set the next dynamic color
+    int first = command == "10" ? PALETTE_DEFAULT_FG : PALETTE_DEFAULT_BG;
+    for (size_t i = 0; i < args.size() && first + i <= PALETTE_DEFAULT_BG; i++) {
+      int index = first + i;
+      set_or_query(index, args[i], std::to_string(10 + index - PALETTE_DEFAULT_FG) + ";");
+    }
+  } else if (command == "104") {
+    // reset the listed palette colors, all of them without arguments
+    if (args.empty() || (args.size() == 1 && args[0].empty())) {
+      for (int i = 0; i < 256; i++) {
+        reset_color(i);
+      }
+    }
+    for (auto arg : args) {
+      int index = -1;
+      std::from_chars(arg.data(), arg.data() + arg.size(), index);
+      if (0 <= index && index < 256) {
+        reset_color(index);
+      }
+    }
+  } else if (command == "110") {
+    reset_color(PALETTE_DEFAULT_FG);
+  } else if (command == "111") {
+    reset_color(PALETTE_DEFAULT_BG);
+  }
+
+  if (palette) {
+    palette_ = std::move(palette);
+  }
+}
+
+// render thread: the screens are resized by the parser thread in apply_pending_resize(), or by the server
+void Session::resize(int rows, int cols) {
+  if (remote()) {
+    int32_t size[2] = {rows, cols};
+    {
+      std::lock_guard lock(output_mutex_);
+      append_remote_message(output_, REMOTE_RESIZE, std::string_view((const char *) size, sizeof(size)));
+    }
+    wakeup();
+    return;
+  }
+  pending_resize_.store(((uint64_t) rows << 32) | (uint32_t) cols);
+  wakeup();
+}
+
+// render thread
+void Session::set_visible(bool visible) {
+  if (visible_.exchange(visible) != visible && visible) {
+    // publish what was parsed while hidden
+    wakeup();
+  }
+}
+
+// parser thread
+void Session::apply_pending_resize() {
+  auto size = pending_resize_.exchange(0);
+  if (size == 0) {
+    return;
+  }
+  int rows = size >> 32, cols = size & 0xffffffffu;
+  if (rows == default_screen_->max_rows_ && cols == default_screen_->max_cols_) {
+    // resizing clears the screens, clients attaching to a server at its size keep what is shown
+    return;
+  }
+  set_tty_window_size(subprocess_->tty_fd(), cols, rows, cols * glyph_width_, rows * glyph_height_);
+
+  default_screen_->resize(rows, cols);
+  alternate_screen_->resize(rows, cols);
+  snapshot_stale_ = true;
+}
+
+void Session::wakeup() {
+  reactor_.wakeup(reactor_worker_, this);
+}
+
+void Session::publish_snapshot() {
+  auto t0 = std::chrono::high_resolution_clock::now();
+  auto snapshot = std::make_shared<ScreenSnapshot>();
+  current_screen_->fill_snapshot(*snapshot);
+  snapshot->window_title = window_title_;
+  snapshot->palette = palette_;
+  snapshot->version = ++snapshot_version_;
+  snapshot_.store(std::move(snapshot));
+  snapshot_stale_ = false;
+  last_publish_ = t0;
+  stats_.record(LatencyStats::STAGE_APPLY, std::chrono::high_resolution_clock::now() - t0);
+  notify();
+}
+
+void Session::notify() const {
+  if (display_) {
+    display_->request_redraw();
+  }
+  if (server_) {
+    server_->wakeup();
+  }
+}
+
+// reactor worker: frames replace the snapshot as they arrive, hidden or not, later frames build on them
+void Session::receive_remote(const char *data, size_t n) {
+  stats_.add_bytes(n);
+  remote_reader_.feed(data, n);
+  RemoteMessage type;
+  std::string_view body;
+  while (remote_reader_.next(type, body)) {
+    if (type != REMOTE_FRAME) {
+      continue;
+    }
+    auto t0 = std::chrono::high_resolution_clock::now();
+    auto snapshot = remote_decoder_.decode(body);
+    if (!snapshot) {
+      std::cerr << "Corrupt frame from the server, detaching" << std::endl;
+      hangup();
+      return;
+    }
+    snapshot->version = ++snapshot_version_;
+    snapshot_.store(std::move(snapshot));
+    stats_.record(LatencyStats::STAGE_APPLY, std::chrono::high_resolution_clock::now() - t0);
+    notify();
+  }
+  if (remote_reader_.corrupt()) {
+    std::cerr << "Corrupt message from the server, detaching" << std::endl;
+    hangup();
+  }
+}
+
+// reactor worker. The render thread never waits for the parser.
+bool Session::service(bool caught_up) {
+  apply_pending_resize();
+  auto now = std::chrono::high_resolution_clock::now();
+  if (now - rate_window_start_ >= publish_interval) {
+    // bytes per interval since the last window, so the intervals without reads end a flood
+    auto intervals = std::max<int64_t>(1, (now - rate_window_start_) / publish_interval);
+    size_t rate = rate_window_bytes_ / intervals;
+    throughput_mode_ = rate >= (throughput_mode_ ? latency_mode_bytes : throughput_mode_bytes);
+    rate_window_bytes_ = 0;
+    rate_window_start_ = now;
+  }
+  // hidden sessions parse without publishing, a session is published once when it is shown
+  if (snapshot_stale_ && visible_ && (caught_up || !throughput_mode_ || now - last_publish_ >= publish_interval)) {
+    publish_snapshot();
+  }
+  return snapshot_stale_ && visible_;
+}
+
+// reactor worker: the render thread notices in exited()
+void Session::hangup() {
+  parser_done_ = true;
+  notify();
+}
+
+void Session::child_exited() {
+  // reap the child, its pidfd is readable once it can be
+  subprocess_->check_exited();
+  child_exited_ = true;
+  notify();
+}
+
+bool Session::take_output(std::string &out, bool idle) {
+  std::lock_guard lock(output_mutex_);
+  if (!output_.empty()) {
+    out += output_;
+    output_.clear();
+    return true;
+  }
+  if (!idle || paste_offset_ == paste_.size()) {
+    return false;
+  }
+  auto chunk = std::string_view(paste_).substr(paste_offset_, paste_chunk_size);
+  if (remote()) {
+    // the server chunks it again for its tty
+    append_remote_message(out, REMOTE_PASTE, chunk);
+  } else {
+    out += chunk;
+  }
+  paste_offset_ += chunk.size();
+  if (paste_offset_ == paste_.size()) {
+    paste_.clear();
+    paste_offset_ = 0;
+  }
+  return true;
+}
+
+void Session::write_to_tty(std::string_view s) {
+  {
+    std::lock_guard lock(output_mutex_);
+    if (remote()) {
+      append_remote_message(output_, REMOTE_INPUT, s);
+    } else {
+      output_ += s;
+    }
+  }
+  wakeup();
+}
+
+void Session::clipboard_paste(std::string_view clipboard_text) {
+  std::string data;
+  bool bracketed_paste = snapshot_.load()->attrs.test(CHAR_ATTR_XTERM_BLOCK_PASTE);
+  if (bracketed_paste) {
+    data += "\x1b[200~";
+  }
+  // UTF8
+  data += clipboard_text;
+  if (bracketed_paste) {
+    data += "\x1b[201~";
+  }
+  queue_paste(data);
+}
+
+void Session::queue_paste(std::string_view data) {
+  {
+    std::lock_guard lock(output_mutex_);
+    paste_ += data;
+  }
+  wakeup();
+}
+
+void Session::switch_screen(bool alternate_screen, bool save_cursor, bool clear) {
+  // The alternate screen is allocated once in resize(), switching never allocates
+  if (alternate_screen) {
+    if (current_screen_ == alternate_screen_.get()) {
+      return;
+    }
+    if (save_cursor) {
+      default_screen_->save_cursor();
+    }
+    if (clear) {
+      alternate_screen_->clear_tty_buffer();
+    }
+    // the alternate screen shares modes with the normal screen
+    alternate_screen_->current_attrs = default_screen_->current_attrs;
+    alternate_screen_->current_fg_color = default_screen_->current_fg_color;
+    alternate_screen_->current_bg_color = default_screen_->current_bg_color;
+    alternate_screen_->cursor_row = default_screen_->cursor_row;
+    alternate_screen_->cursor_col = default_screen_->cursor_col;
+    current_screen_ = alternate_screen_.get();
+  } else {
+    if (current_screen_ == default_screen_.get()) {
+      return;
+    }
+    if (clear) {
+      alternate_screen_->clear_tty_buffer();
+    }
+    default_screen_->current_attrs = alternate_screen_->current_attrs;
+    default_screen_->current_fg_color = alternate_screen_->current_fg_color;
+    default_screen_->current_bg_color = alternate_screen_->current_bg_color;
+    if (save_cursor) {
+      default_screen_->restore_cursor();
+    }
+    current_screen_ = default_screen_.get();
+  }
+}
+void Session::got_character(uint32_t cp) {
+  auto &screen = *current_screen_;
+  std::string c;
+  utf8_encode(cp, c);
+  uint8_t properties = unicode_properties(cp);
+  int width = std::min<int>(properties & 3u, screen.max_cols_);
+  // combining marks, emoji ZWJ sequences and the like join the grapheme written last
+  if (!screen.grapheme_breaker.is_break(static_cast<GraphemeBreakClass>(properties >> 2u))
+      && screen.append_to_last_grapheme(c)) {
+    return;
+  }
+  if (width == 0) {
+    // nothing to combine with, takes a cell of its own
+    width = 1;
+  }
+
+  if (screen.current_attrs.test(CHAR_ATTR_AUTO_WRAP_MODE)) {
+    // https://www.vt100.net/docs/vt510-rm/DECAWM.html
+    // If the DECAWM function is set,
+    // then graphic characters received when the cursor is at the right border of the page
+    //  appear at the beginning of the next line.
+    // Any text on the page scrolls up if the cursor is at the end of the scrolling region.
+    // A double width character that does not fit in the last column wraps as well.
+    if (screen.cursor_col + width > screen.max_cols_) {
+      screen.new_line();
+      screen.carriage_return();
+    }
+    screen.fill_current_cursor(std::move(c), width);
+    screen.cursor_col += width;
+  } else {
+    // If the DECAWM function is reset,
+    // then graphic characters received when the cursor is at the right border of the page
+    //  replace characters already on the page.
+    screen.cursor_col = std::min(screen.cursor_col, screen.max_cols_ - width);
+    screen.fill_current_cursor(std::move(c), width);
+    screen.cursor_col = std::min(screen.cursor_col + width, screen.max_cols_ - 1);
+  }
+}
+void Session::log_verbose_input_char(uint32_t c, bool has_color) {
+  if (std::isprint(c)) {
+    log_stream_.put(c);
+    log_stream_.flush();
+  } else {
+    if (c == '\n') {
+      log_stream_.put(c);
+    } else {
+      if (has_color) {
+        log_stream_ << "\x1b[33m{\x1b[32m";
+      } else {
+        log_stream_ << "{";
+      }
+
+      if (c < sizeof(escape_table)/sizeof(escape_table[0]) && escape_table[c]) {
+        log_stream_ << escape_table[c];
+      } else {
+        log_stream_ << "\\x" << std::setw(2) << std::setfill('0') << std::hex << c;
+      }
+      if (has_color) {
+        log_stream_ << "\x1b[33m}\x1b[0m";
+      } else {
+        log_stream_ << "}";
+      }
+      log_stream_.flush();
+    }
+  }
+  std::cout << "char at (" << std::dec << current_screen_->cursor_row << "," << current_screen_->cursor_col << "): 0x" <<
+            std::setw(2) << std::setfill('0') << std::hex << (int)(uint8_t)c;
+  if (std::isprint(c) && c != '\n') {
+    std::cout << " '" << c << '\'';
+  }
+  std::cout << std::endl;
+
+}
+
+}
@@ -0,0 +1,224 @@
+#include <te/software_compositor.hpp>
+
+#include <cstring>
+
+#include <algorithm>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include <SDL2/SDL.h>
+
+namespace te {
+
+// x / 255 for x in [0, 255 * 255], exact with rounding
+static inline uint32_t div255(uint32_t x) {
+  x += 128;
+  return (x + (x >> 8u)) >> 8u;
+}
+
+static void blend_span_scalar(uint32_t *dst, const uint8_t *mask, int n, uint32_t color) {
+  for (int i = 0; i < n; i++) {
+    uint32_t a = mask[i];
+    if (a == 0) {
+      continue;
+    } else if (a == 255) {
+      dst[i] = color;
+      continue;
+    }
+    uint32_t d = dst[i], result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+      uint32_t c = (color >> shift) & 0xffu, b = (d >> shift) & 0xffu;
+      result |= div255(c * a + b * (255 - a)) << shift;
+    }
+    dst[i] = result;
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// x / 255 on 16 bit lanes holding values in [0, 255 * 255]
+__attribute__((target("sse2")))
+static inline __m128i div255_epu16(__m128i x) {
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// 4 pixels per iteration
+__attribute__((target("sse2")))
+static void blend_span_sse2(uint32_t *dst, const uint8_t *mask, int n, uint32_t color) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i c16 = _mm_unpacklo_epi8(_mm_set1_epi32(color), zero);
+  const __m128i full = _mm_set1_epi16(255);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint32_t m;
+    memcpy(&m, mask + i, 4);
+    if (m == 0) {
+      continue;
+    }
+    // a0 a0 a0 a0 a1 a1 a1 a1 ...
+    __m128i a = _mm_cvtsi32_si128(m);
+    a = _mm_unpacklo_epi8(a, a);
+    a = _mm_unpacklo_epi16(a, a);
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+
+    __m128i a_lo = _mm_unpacklo_epi8(a, zero), a_hi = _mm_unpackhi_epi8(a, zero);
+    __m128i d_lo = _mm_unpacklo_epi8(d, zero), d_hi = _mm_unpackhi_epi8(d, zero);
+    __m128i r_lo = _mm_add_epi16(_mm_mullo_epi16(c16, a_lo), _mm_mullo_epi16(d_lo, _mm_sub_epi16(full, a_lo)));
+    __m128i r_hi = _mm_add_epi16(_mm_mullo_epi16(c16, a_hi), _mm_mullo_epi16(d_hi, _mm_sub_epi16(full, a_hi)));
+    __m128i result = _mm_packus_epi16(div255_epu16(r_lo), div255_epu16(r_hi));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), result);
+  }
+  blend_span_scalar(dst + i, mask + i, n - i, color);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i div255_epu16_avx2(__m256i x) {
+  x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+// 8 pixels per iteration
+__attribute__((target("avx2")))
+static void blend_span_avx2(uint32_t *dst, const uint8_t *mask, int n, uint32_t color) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i c16 = _mm256_unpacklo_epi8(_mm256_set1_epi32(color), zero);
+  const __m256i full = _mm256_set1_epi16(255);
+  const __m256i broadcast = _mm256_set1_epi32(0x01010101);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t m;
+    memcpy(&m, mask + i, 8);
+    if (m == 0) {
+      continue;
+    }
+    // alpha of each pixel in all of its 4 bytes
+    __m256i a = _mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(mask + i))),
+                                   broadcast);
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+
+    // unpack and pack both work within 128 bit lanes, the pixel order is kept
+    __m256i a_lo = _mm256_unpacklo_epi8(a, zero), a_hi = _mm256_unpackhi_epi8(a, zero);
+    __m256i d_lo = _mm256_unpacklo_epi8(d, zero), d_hi = _mm256_unpackhi_epi8(d, zero);
+    __m256i r_lo = _mm256_add_epi16(_mm256_mullo_epi16(c16, a_lo), _mm256_mullo_epi16(d_lo, _mm256_sub_epi16(full, a_lo)));
+    __m256i r_hi = _mm256_add_epi16(_mm256_mullo_epi16(c16, a_hi), _mm256_mullo_epi16(d_hi, _mm256_sub_epi16(full, a_hi)));
+    __m256i result = _mm256_packus_epi16(div255_epu16_avx2(r_lo), div255_epu16_avx2(r_hi));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), result);
+  }
+  blend_span_sse2(dst + i, mask + i, n - i, color);
+}
+#endif
+
+SoftwareCompositor::SoftwareCompositor() {
+  blend_span_ = blend_span_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    blend_span_ = blend_span_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    blend_span_ = blend_span_sse2;
+  }
+#endif
+}
+
+void SoftwareCompositor::resize(int w, int h) {
+  w_ = w;
+  h_ = h;
+  pixels_.assign((size_t) w * h, 0xff000000u);
+  const_mask_.resize(w);
+  mark_dirty(0, h_);
+}
+
+void SoftwareCompositor::mark_dirty(int y, int h) {
+  if (dirty_begin_ == dirty_end_) {
+    dirty_begin_ = y;
+    dirty_end_ = y + h;
+  } else {
+    dirty_begin_ = std::min(dirty_begin_, y);
+    dirty_end_ = std::max(dirty_end_, y + h);
+  }
+}
+
+void SoftwareCompositor::fill_rect(int x, int y, int w, int h, Color color) {
+  int x0 = std::max(x, 0), y0 = std::max(y, 0);
+  int x1 = std::min(x + w, w_), y1 = std::min(y + h, h_);
+  if (x0 >= x1 || y0 >= y1) {
+    return;
+  }
+  for (int row = y0; row < y1; row++) {
+    std::fill_n(pixels_.data() + (size_t) row * w_ + x0, x1 - x0, color.u32);
+  }
+  mark_dirty(y0, y1 - y0);
+}
+
+void SoftwareCompositor::blend_rect(int x, int y, int w, int h, Color color, uint8_t alpha) {
+  int x0 = std::max(x, 0), y0 = std::max(y, 0);
+  int x1 = std::min(x + w, w_), y1 = std::min(y + h, h_);
+  if (x0 >= x1 || y0 >= y1) {
+    return;
+  }
+  std::fill_n(const_mask_.data(), x1 - x0, alpha);
+  for (int row = y0; row < y1; row++) {
+    blend_span_(pixels_.data() + (size_t) row * w_ + x0, const_mask_.data(), x1 - x0, color.u32);
+  }
+  mark_dirty(y0, y1 - y0);
+}
+
+void SoftwareCompositor::blend_mask(int x,
+                                    int y,
+                                    int clip_w,
+                                    int clip_h,
+                                    const uint8_t *mask,
+                                    int mask_w,
+                                    int mask_h,
+                                    Color color) {
+  int w = std::min(clip_w, mask_w), h = std::min(clip_h, mask_h);
+  int x0 = std::max(x, 0), y0 = std::max(y, 0);
+  int x1 = std::min(x + w, w_), y1 = std::min(y + h, h_);
+  if (x0 >= x1 || y0 >= y1) {
+    return;
+  }
+  color.a = 0xff;
+  for (int row = y0; row < y1; row++) {
+    blend_span_(pixels_.data() + (size_t) row * w_ + x0, mask + (size_t) (row - y) * mask_w + (x0 - x), x1 - x0, color.u32);
+  }
+  mark_dirty(y0, y1 - y0);
+}
+
+void SoftwareCompositor::move_rows(int x, int w, int src_y, int dst_y, int h) {
+  if (h <= 0) {
+    return;
+  }
+  if (x == 0 && w == w_) {
+    memmove(pixels_.data() + (size_t) dst_y * w_, pixels_.data() + (size_t) src_y * w_, (size_t) h * w_ * 4);
+  } else {
+    // a pane next to another one, row by row in the order that does not overwrite the rows still to move
+    for (int i = 0; i < h; i++) {
+      int row = dst_y > src_y ? h - 1 - i : i;
+      memmove(pixels_.data() + (size_t) (dst_y + row) * w_ + x, pixels_.data() + (size_t) (src_y + row) * w_ + x, (size_t) w * 4);
+    }
+  }
+  mark_dirty(dst_y, h);
+}
+
+void SoftwareCompositor::copy_rows(int x, int y, int w, int h, const uint32_t *pixels, int stride) {
+  for (int row = 0; row < h; row++) {
+    memcpy(pixels_.data() + (size_t) (y + row) * w_ + x, pixels + (size_t) row * stride, (size_t) w * 4);
+  }
+  mark_dirty(y, h);
+}
+
+void SoftwareCompositor::upload(SDL_Texture *texture) {
+  if (dirty_begin_ == dirty_end_) {
+    return;
+  }
+  SDL_Rect rect{0, dirty_begin_, w_, dirty_end_ - dirty_begin_};
+  if (SDL_UpdateTexture(texture, &rect, pixels_.data() + (size_t) dirty_begin_ * w_, w_ * 4) != 0) {
+    std::cerr << "Failed to upload framebuffer: " << SDL_GetError() << std::endl;
+  }
+  dirty_begin_ = dirty_end_ = 0;
+}
+
+}
@@ -1,6 +1,7 @@
 #define _POSIX_SOURCE
 #include <te/subprocess.hpp>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <iostream>
 #include <vector>
@@ -8,6 +9,8 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/syscall.h>
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <wait.h>
@@ -67,6 +70,9 @@ Subprocess::Subprocess(std::string command_line,
   } else if (pid == 0) {
     // child
 
+    // te ignores SIGPIPE for its sockets, ignored signals would stay ignored across execve()
+    signal(SIGPIPE, SIG_DFL);
+
     // create a new process group and assume leader
     if (setsid() < 0) {
       perror("setsid");
@@ -106,10 +112,28 @@ Subprocess::Subprocess(std::string command_line,
   } else {
     child_pid_ = pid;
     tty_fd_ = master_pty;
+    // lets the I/O reactor wait for the exit instead of polling waitid()
+    pid_fd_ = syscall(SYS_pidfd_open, pid, 0);
+  }
+}
+
+Subprocess::~Subprocess() {
+  if (tty_fd_ >= 0) {
+    close(tty_fd_);
+  }
+  if (pid_fd_ >= 0) {
+    close(pid_fd_);
+  }
+  if (child_pid_ > 0 && !exited_) {
+    // the child may take a while to exit, or ignore the hangup
+    std::thread([pid = child_pid_]() { waitpid(pid, nullptr, 0); }).detach();
   }
 }
 
 bool Subprocess::check_exited() const {
+  if (exited_) {
+    return true;
+  }
   siginfo_t siginfo;
   siginfo.si_pid = 0;
   if (waitid(P_PID, child_pid_, &siginfo, WEXITED | WNOHANG) < 0) {
@@ -120,6 +144,7 @@ bool Subprocess::check_exited() const {
   if (siginfo.si_pid == 0) {
     return false;
   } else {
+    exited_ = true;
     return true;
   }
 }
@@ -1,6 +1,13 @@
 #include <te/tty_input.hpp>
 
 #include <cassert>
+#include <cstring>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include <te/basic.hpp>
 
@@ -131,5 +138,345 @@ TTYInputType TTYInput::receive_char(char cc) {
   }
 }
 
+/**
+ * UTF-8 text
+ *
+ * Text between control characters is decoded in bulk: the end of the text is found 16 bytes at a time,
+ *  the text is validated 16 bytes at a time, and valid text is decoded without further checks.
+ * Only text with errors takes the byte by byte path that substitutes U+FFFD.
+ */
+
+// Decode one sequence of s[0, n), n > 0, following the well-formed byte sequences of Unicode table 3-7.
+// Returns the bytes consumed, cp is 0xfffd for a malformed sequence, which consumes its maximal subpart.
+// Returns -k if the first k bytes are a valid but incomplete sequence.
+static int utf8_sequence(const uint8_t *s, size_t n, uint32_t &cp) {
+  uint8_t b = s[0];
+  int total;
+  uint8_t lo = 0x80, hi = 0xbf;
+  if (b < 0x80u) {
+    cp = b;
+    return 1;
+  } else if (b >= 0xc2u && b <= 0xdfu) {
+    total = 2;
+    cp = b & 0x1fu;
+  } else if (b >= 0xe0u && b <= 0xefu) {
+    total = 3;
+    cp = b & 0x0fu;
+    if (b == 0xe0u) {
+      lo = 0xa0;
+    } else if (b == 0xedu) {
+      // surrogates
+      hi = 0x9f;
+    }
+  } else if (b >= 0xf0u && b <= 0xf4u) {
+    total = 4;
+    cp = b & 0x07u;
+    if (b == 0xf0u) {
+      lo = 0x90;
+    } else if (b == 0xf4u) {
+      hi = 0x8f;
+    }
+  } else {
+    cp = 0xfffd;
+    return 1;
+  }
+  for (int k = 1; k < total; k++) {
+    if ((size_t) k >= n) {
+      return -k;
+    }
+    uint8_t c = s[k];
+    if (c < lo || c > hi) {
+      cp = 0xfffd;
+      return k;
+    }
+    lo = 0x80;
+    hi = 0xbf;
+    cp = (cp << 6u) | (c & 0x3fu);
+  }
+  return total;
+}
+
+static size_t text_length_scalar(const uint8_t *s, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (s[i] < 0x20u || s[i] == 0x7fu) {
+      return i;
+    }
+  }
+  return n;
+}
+
+static bool utf8_validate_scalar(const uint8_t *s, size_t n) {
+  size_t i = 0;
+  while (i < n) {
+    uint32_t cp;
+    int k = utf8_sequence(s + i, n - i, cp);
+    if (k < 0 || cp == 0xfffd) {
+      return false;
+    }
+    i += k;
+  }
+  return true;
+}
+
+// s[0, n) is valid UTF-8, returns the number of code points
+static size_t utf8_decode_valid_scalar(const uint8_t *s, size_t n, uint32_t *out) {
+  auto begin = out;
+  size_t i = 0;
+  while (i < n) {
+    uint32_t b = s[i];
+    if (b < 0x80u) {
+      *out++ = b;
+      i += 1;
+    } else if (b < 0xe0u) {
+      *out++ = ((b & 0x1fu) << 6u) | (s[i + 1] & 0x3fu);
+      i += 2;
+    } else if (b < 0xf0u) {
+      *out++ = ((b & 0x0fu) << 12u) | ((s[i + 1] & 0x3fu) << 6u) | (s[i + 2] & 0x3fu);
+      i += 3;
+    } else {
+      *out++ = ((b & 0x07u) << 18u) | ((s[i + 1] & 0x3fu) << 12u) | ((s[i + 2] & 0x3fu) << 6u) | (s[i + 3] & 0x3fu);
+      i += 4;
+    }
+  }
+  return out - begin;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// bytes below 0x20 and 0x7f
+__attribute__((target("sse2")))
+static size_t text_length_sse2(const uint8_t *s, size_t n) {
+  const __m128i max_control = _mm_set1_epi8(0x1f), del = _mm_set1_epi8(0x7f);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    __m128i control = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, max_control), v), _mm_cmpeq_epi8(v, del));
+    int mask = _mm_movemask_epi8(control);
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + text_length_scalar(s + i, n - i);
+}
+
+// Keiser and Lemire, Validating UTF-8 in less than one instruction per byte, 2021.
+// Every error shows up as a bit set in the three nibble lookups of a byte and its predecessor,
+//  3 and 4 byte sequences are checked by looking 2 and 3 bytes back.
+namespace utf8_lookup {
+constexpr uint8_t TOO_SHORT = 1u << 0u;
+constexpr uint8_t TOO_LONG = 1u << 1u;
+constexpr uint8_t OVERLONG_3 = 1u << 2u;
+constexpr uint8_t TOO_LARGE = 1u << 3u;
+constexpr uint8_t SURROGATE = 1u << 4u;
+constexpr uint8_t OVERLONG_2 = 1u << 5u;
+constexpr uint8_t TOO_LARGE_1000 = 1u << 6u;
+constexpr uint8_t OVERLONG_4 = 1u << 6u;
+constexpr uint8_t TWO_CONTS = 1u << 7u;
+constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i utf8_block_errors(__m128i input, __m128i prev_input) {
+  using namespace utf8_lookup;
+  const __m128i byte_1_high_table = _mm_setr_epi8(
+      TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+      TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+      TOO_SHORT | OVERLONG_2,
+      TOO_SHORT,
+      TOO_SHORT | OVERLONG_3 | SURROGATE,
+      TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+  const __m128i byte_1_low_table = _mm_setr_epi8(
+      CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+      CARRY | OVERLONG_2,
+      CARRY,
+      CARRY,
+      CARRY | TOO_LARGE,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000);
+  const __m128i byte_2_high_table = _mm_setr_epi8(
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+  const __m128i low_nibble = _mm_set1_epi8(0x0f);
+
+  __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+  __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table, _mm_and_si128(_mm_srli_epi16(prev1, 4), low_nibble));
+  __m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, low_nibble));
+  __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table, _mm_and_si128(_mm_srli_epi16(input, 4), low_nibble));
+  __m128i special_cases = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+  __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+  __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+  __m128i is_third_byte = _mm_subs_epu8(prev2, _mm_set1_epi8((char) (0xe0u - 0x80u)));
+  __m128i is_fourth_byte = _mm_subs_epu8(prev3, _mm_set1_epi8((char) (0xf0u - 0x80u)));
+  __m128i must_be_continuation = _mm_and_si128(_mm_or_si128(is_third_byte, is_fourth_byte), _mm_set1_epi8((char) 0x80));
+  return _mm_xor_si128(must_be_continuation, special_cases);
+}
 
-}
\ No newline at end of file
+__attribute__((target("ssse3")))
+static bool utf8_validate_ssse3(const uint8_t *s, size_t n) {
+  __m128i error = _mm_setzero_si128(), prev = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    error = _mm_or_si128(error, utf8_block_errors(input, prev));
+    prev = input;
+  }
+  // the rest padded with zeros, then one zero block to catch a sequence cut at the end
+  uint8_t last[16] = {};
+  memcpy(last, s + i, n - i);
+  __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(last));
+  error = _mm_or_si128(error, utf8_block_errors(input, prev));
+  error = _mm_or_si128(error, utf8_block_errors(_mm_setzero_si128(), input));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xffff;
+}
+
+// widens runs of 16 ASCII bytes at once
+__attribute__((target("sse2")))
+static size_t utf8_decode_valid_sse2(const uint8_t *s, size_t n, uint32_t *out) {
+  auto begin = out;
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  while (i < n) {
+    if (i + 16 <= n) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+      if (_mm_movemask_epi8(v) == 0) {
+        __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm_unpackhi_epi16(hi, zero));
+        i += 16;
+        out += 16;
+        continue;
+      }
+    }
+    // up to the next 16 byte boundary of the input, sequences never end past n
+    size_t end = std::min(n, i + 16);
+    while (i < end) {
+      uint32_t b = s[i];
+      if (b < 0x80u) {
+        *out++ = b;
+        i += 1;
+      } else if (b < 0xe0u) {
+        *out++ = ((b & 0x1fu) << 6u) | (s[i + 1] & 0x3fu);
+        i += 2;
+      } else if (b < 0xf0u) {
+        *out++ = ((b & 0x0fu) << 12u) | ((s[i + 1] & 0x3fu) << 6u) | (s[i + 2] & 0x3fu);
+        i += 3;
+      } else {
+        *out++ = ((b & 0x07u) << 18u) | ((s[i + 1] & 0x3fu) << 12u) | ((s[i + 2] & 0x3fu) << 6u) | (s[i + 3] & 0x3fu);
+        i += 4;
+      }
+    }
+  }
+  return out - begin;
+}
+#endif
+
+UTF8Kernels::UTF8Kernels(bool simd)
+    :text_length(text_length_scalar), validate(utf8_validate_scalar), decode_valid(utf8_decode_valid_scalar) {
+  if (!simd) {
+    return;
+  }
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    text_length = text_length_sse2;
+    decode_valid = utf8_decode_valid_sse2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    validate = utf8_validate_ssse3;
+  }
+#endif
+}
+
+const UTF8Kernels &UTF8Kernels::best() {
+  static const UTF8Kernels kernels(true);
+  return kernels;
+}
+
+size_t TTYInput::decode_text(const char *data, size_t size, std::vector<uint32_t> &codepoints) {
+  auto s = reinterpret_cast<const uint8_t*>(data);
+  auto &kernels = UTF8Kernels::best();
+  codepoints.clear();
+  size_t i = 0;
+
+  // complete the sequence cut by the previous read
+  if (input_state == InputState::UTF8) {
+    uint32_t cp = 0xfffd;
+    int k = -1;
+    while (i < size && k < 0) {
+      buffer_.push_back(s[i]);
+      k = utf8_sequence(reinterpret_cast<const uint8_t*>(buffer_.data()), buffer_.size(), cp);
+      if (k >= 0 && k < (int) buffer_.size()) {
+        // s[i] does not continue the sequence, it is decoded on its own
+        buffer_.pop_back();
+        break;
+      }
+      i++;
+    }
+    if (k < 0 && i == size) {
+      return i;
+    }
+    // a malformed or interrupted sequence is one U+FFFD
+    codepoints.push_back(k == (int) buffer_.size() ? cp : 0xfffd);
+    input_state = InputState::Idle;
+  }
+
+  size_t end = i + kernels.text_length(s + i, size - i);
+  size_t text_end = end;
+  if (end == size) {
+    // a sequence cut by the end of the read waits for the next one
+    for (size_t back = 1; back <= 3 && back <= end - i; back++) {
+      uint8_t b = s[end - back];
+      if ((b & 0xc0u) != 0x80u) {
+        uint32_t cp;
+        int k = utf8_sequence(s + end - back, back, cp);
+        if (k < 0) {
+          text_end = end - back;
+          buffer_.assign(data + text_end, back);
+          utf8_read = back;
+          utf8_total = (b & 0xe0u) == 0xc0u ? 2 : (b & 0xf0u) == 0xe0u ? 3 : 4;
+          input_state = InputState::UTF8;
+        }
+        break;
+      }
+    }
+  }
+
+  size_t n = text_end - i;
+  size_t first = codepoints.size();
+  codepoints.resize(first + n);
+  if (kernels.validate(s + i, n)) {
+    codepoints.resize(first + kernels.decode_valid(s + i, n, codepoints.data() + first));
+  } else {
+    size_t count = first;
+    for (size_t j = i; j < text_end;) {
+      uint32_t cp;
+      int k = utf8_sequence(s + j, text_end - j, cp);
+      if (k < 0) {
+        // cut by a control character
+        cp = 0xfffd;
+        k = -k;
+      }
+      codepoints[count++] = cp;
+      j += k;
+    }
+    codepoints.resize(count);
+  }
+  return end;
+}
+
+}
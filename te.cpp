@@ -1,31 +1,101 @@
+#include <csignal>
+#include <cstdlib>
 #include <string>
 #include <vector>
 
 #include <te/display.hpp>
+#include <te/remote.hpp>
+
+static void usage(const char *argv0) {
+  std::cerr << "usage: " << argv0 << " [--latency-bench [--samples N] [--headless]] [--server PATH | --attach PATH] [--verbose]"
+            << " [-e /path/to/command args...]" << std::endl
+            << "  --latency-bench  measure key-to-screen latency of the command, e.g. -e /bin/cat, and exit" << std::endl
+            << "  --samples N      key presses to measure, default 200" << std::endl
+            << "  --headless       render offscreen with the software renderer, for CI" << std::endl
+            << "  --server PATH    run the command without a window until it exits, windows attach at PATH" << std::endl
+            << "  --attach PATH    show the session of the server at PATH in the first pane" << std::endl
+            << "  --verbose        trace every control sequence of the first session to a.log and stdout" << std::endl;
+  exit(1);
+}
 
 int main(int argc, char **argv, char **envp) {
+  std::vector<std::string> command{"/bin/bash"};
+  bool latency_bench = false, headless = false, verbose = false;
+  int bench_samples = 200;
+  std::string server_socket_path, attach_socket_path;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--latency-bench") {
+      latency_bench = true;
+    } else if (arg == "--samples" && i + 1 < argc) {
+      bench_samples = std::atoi(argv[++i]);
+    } else if (arg == "--headless") {
+      headless = true;
+    } else if (arg == "--server" && i + 1 < argc) {
+      server_socket_path = argv[++i];
+    } else if (arg == "--attach" && i + 1 < argc) {
+      attach_socket_path = argv[++i];
+    } else if (arg == "--verbose") {
+      verbose = true;
+    } else if (arg == "-e" && i + 1 < argc) {
+      command.assign(argv + i + 1, argv + argc);
+      break;
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (headless) {
+    // before SDL_Init
+    setenv("SDL_VIDEODRIVER", "offscreen", 1);
+  }
+
+  // a client or server that goes away fails the write to its socket instead of killing te
+  signal(SIGPIPE, SIG_IGN);
+
   std::vector<std::string> environments;
   for (int i = 0; envp[i]; i++) {
     environments.emplace_back(envp[i]);
   }
 
   std::string font_file = "/usr/share/fonts/TTF/DejaVuSansMono.ttf";
+  std::vector<std::string> fallback_font_files = {
+      "/usr/share/fonts/noto-cjk/NotoSansCJK-Regular.ttc",
+      "/usr/share/fonts/noto/NotoSansSymbols2-Regular.ttf",
+  };
   int font_size = 34;
+  // at most 16 atlas pages of 1024x1024
+  size_t glyph_cache_bytes = 64 * 1024 * 1024;
   std::string log_file_path = "a.log";
   std::ofstream log_stream(log_file_path, std::ios::trunc);
   if (!log_stream) {
     std::cerr << "Failed to open log file '" << log_file_path << "'" << std::endl;
     abort();
   }
-  bool use_acceleration = true;
+  if (!server_socket_path.empty()) {
+    // no window, the session outlives the windows attached to it
+    te::RemoteServer server(log_stream, command, "rxvt", environments, server_socket_path, verbose);
+    server.loop();
+    return 0;
+  }
+  bool use_acceleration = !headless;
+  // latency histograms as JSON, also dumped to stderr on SIGUSR1
+  std::string stats_socket_path = te::LatencyStatsServer::default_socket_path();
   te::Display display(
       log_stream,
-      {"/bin/bash"},
+      command,
       "rxvt",
       font_file,
+      fallback_font_files,
       font_size,
+      glyph_cache_bytes,
       "/home/alexwang/bg.png",
       environments,
-      use_acceleration);
+      use_acceleration,
+      stats_socket_path,
+      attach_socket_path,
+      verbose);
+  if (latency_bench) {
+    display.enable_latency_bench(bench_samples);
+  }
   display.loop();
 }
@@ -0,0 +1,61 @@
+// Grapheme clusters of GraphemeBreaker against examples of the UAX #29 rules.
+#include <cstdio>
+
+#include <string>
+#include <vector>
+
+#include <te/unicode.hpp>
+
+using namespace te;
+
+static int failures = 0;
+
+// split codepoints into graphemes
+static std::vector<std::vector<uint32_t>> graphemes(const std::vector<uint32_t> &codepoints) {
+  std::vector<std::vector<uint32_t>> result;
+  GraphemeBreaker breaker;
+  for (uint32_t cp : codepoints) {
+    if (breaker.is_break(grapheme_break_class(cp)) || result.empty()) {
+      result.emplace_back();
+    }
+    result.back().push_back(cp);
+  }
+  return result;
+}
+
+static void check(const char *name, const std::vector<uint32_t> &codepoints,
+                  const std::vector<std::vector<uint32_t>> &expected) {
+  auto result = graphemes(codepoints);
+  if (result != expected) {
+    fprintf(stderr, "%s: %zu graphemes, expected %zu\n", name, result.size(), expected.size());
+    failures++;
+  }
+}
+
+int main() {
+  // GB9: combining marks extend the base
+  check("e + acute", {'e', 0x301, 'x'}, {{'e', 0x301}, {'x'}});
+  check("stacked marks", {'a', 0x300, 0x316, 0x35c}, {{'a', 0x300, 0x316, 0x35c}});
+  // GB4, GB5: controls stand alone, even before a mark
+  check("control", {'a', 0x7f, 0x301}, {{'a'}, {0x7f}, {0x301}});
+  // GB11: emoji ZWJ sequences, man ZWJ woman ZWJ girl
+  check("family", {0x1f468, 0x200d, 0x1f469, 0x200d, 0x1f467}, {{0x1f468, 0x200d, 0x1f469, 0x200d, 0x1f467}});
+  check("skin tone", {0x1f44d, 0x1f3fd, 0x1f44d}, {{0x1f44d, 0x1f3fd}, {0x1f44d}});
+  check("zwj without emoji", {'a', 0x200d, 0x1f467}, {{'a', 0x200d}, {0x1f467}});
+  // GB12, GB13: regional indicators pair up, US DE then a lone U
+  check("flags", {0x1f1fa, 0x1f1f8, 0x1f1e9, 0x1f1ea, 0x1f1fa},
+        {{0x1f1fa, 0x1f1f8}, {0x1f1e9, 0x1f1ea}, {0x1f1fa}});
+  // GB6, GB7, GB8: Hangul syllables, L V T, LV T and LVT T
+  check("hangul L V T", {0x1100, 0x1161, 0x11a8, 0x1100}, {{0x1100, 0x1161, 0x11a8}, {0x1100}});
+  check("hangul LV T", {0xac00, 0x11a8, 0xac00}, {{0xac00, 0x11a8}, {0xac00}});
+  check("hangul LVT T", {0xac01, 0x11a8, 0x1161}, {{0xac01, 0x11a8}, {0x1161}});
+  check("hangul L LV", {0x1100, 0xac00, 0xac00}, {{0x1100, 0xac00}, {0xac00}});
+  // GB9a: spacing marks, Devanagari ka + vowel sign i
+  check("spacing mark", {0x915, 0x93f, 0x915}, {{0x915, 0x93f}, {0x915}});
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,164 @@
+// Split fuzz test of the UTF-8 decoder: random text decoded by TTYInput in random chunks must match a
+//  byte by byte reference decoder, and the SIMD kernels must agree with the scalar ones.
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <te/tty_input.hpp>
+
+using namespace te;
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                   \
+  do {                                                     \
+    if (!(cond)) {                                         \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);      \
+      fprintf(stderr, __VA_ARGS__);                        \
+      fprintf(stderr, "\n");                               \
+      failures++;                                          \
+    }                                                      \
+  } while (0)
+
+// Unicode 3.9, table 3-7, every maximal subpart of an ill-formed sequence is one U+FFFD
+static std::vector<uint32_t> reference_decode(const std::string &text) {
+  std::vector<uint32_t> out;
+  auto s = reinterpret_cast<const uint8_t*>(text.data());
+  size_t n = text.size(), i = 0;
+  while (i < n) {
+    uint8_t b = s[i];
+    int total = 0;
+    uint32_t cp = 0;
+    uint8_t lo = 0x80, hi = 0xbf;
+    if (b < 0x80) {
+      out.push_back(b);
+      i++;
+      continue;
+    } else if (b >= 0xc2 && b <= 0xdf) {
+      total = 2, cp = b & 0x1f;
+    } else if (b >= 0xe0 && b <= 0xef) {
+      total = 3, cp = b & 0x0f;
+      lo = b == 0xe0 ? 0xa0 : 0x80;
+      hi = b == 0xed ? 0x9f : 0xbf;
+    } else if (b >= 0xf0 && b <= 0xf4) {
+      total = 4, cp = b & 0x07;
+      lo = b == 0xf0 ? 0x90 : 0x80;
+      hi = b == 0xf4 ? 0x8f : 0xbf;
+    } else {
+      out.push_back(0xfffd);
+      i++;
+      continue;
+    }
+    int k = 1;
+    for (; k < total && i + k < n; k++) {
+      uint8_t c = s[i + k];
+      if (c < lo || c > hi) {
+        break;
+      }
+      lo = 0x80, hi = 0xbf;
+      cp = (cp << 6) | (c & 0x3f);
+    }
+    out.push_back(k == total ? cp : 0xfffd);
+    i += k;
+  }
+  return out;
+}
+
+// text, malformed and cut sequences and a few control characters
+static std::string random_text(std::mt19937 &rng, size_t size) {
+  static const char *pieces[] = {
+      "a", "hello world ", "0123456789abcdef0123456789", "\n", "\r", "\t",
+      "\xc3\xa9", "\xe2\x94\x80", "\xe4\xb8\xad\xe6\x96\x87", "\xf0\x9f\x98\x80",
+      // ill-formed: lone continuation, overlong, surrogate, too large, cut sequences, invalid bytes
+      "\x80", "\xc0\xaf", "\xe0\x80\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\xe2\x94", "\xf0\x9f\x98",
+      "\xc3", "\xff", "\xfe",
+  };
+  std::string text;
+  std::uniform_int_distribution<size_t> pick(0, std::size(pieces) - 1);
+  while (text.size() < size) {
+    text += pieces[pick(rng)];
+  }
+  // nothing left waiting for the next read at the end
+  text += "x";
+  return text;
+}
+
+// decode text in chunks ending at the given split points, as the session does with the reads of a tty
+static std::vector<uint32_t> decode_in_chunks(const std::string &text, const std::vector<size_t> &splits) {
+  TTYInput input;
+  std::vector<uint32_t> out, codepoints;
+  size_t start = 0;
+  for (size_t split : splits) {
+    size_t i = start;
+    while (i < split) {
+      if (input.accepts_text()) {
+        size_t n = input.decode_text(text.data() + i, split - i, codepoints);
+        out.insert(out.end(), codepoints.begin(), codepoints.end());
+        i += n;
+        if (i == split) {
+          break;
+        }
+      }
+      // the control characters of the generator are single byte Chars
+      input.receive_char(text[i]);
+      out.push_back((uint8_t) text[i]);
+      i++;
+    }
+    start = split;
+  }
+  return out;
+}
+
+static void test_split_fuzz(std::mt19937 &rng) {
+  for (int round = 0; round < 2000; round++) {
+    auto text = random_text(rng, std::uniform_int_distribution<size_t>(1, 300)(rng));
+    auto expected = reference_decode(text);
+    std::vector<size_t> splits;
+    std::uniform_int_distribution<size_t> chunk(1, 40);
+    for (size_t pos = chunk(rng); pos < text.size(); pos += chunk(rng)) {
+      splits.push_back(pos);
+    }
+    splits.push_back(text.size());
+    CHECK(decode_in_chunks(text, splits) == expected, "round %d: chunked decode differs from the reference", round);
+    CHECK(decode_in_chunks(text, {text.size()}) == expected, "round %d: decode differs from the reference", round);
+  }
+}
+
+static void test_kernels(std::mt19937 &rng) {
+  UTF8Kernels scalar(false);
+  auto &best = UTF8Kernels::best();
+  std::vector<uint32_t> out_scalar, out_best;
+  for (int round = 0; round < 2000; round++) {
+    auto text = random_text(rng, std::uniform_int_distribution<size_t>(1, 200)(rng));
+    auto s = reinterpret_cast<const uint8_t*>(text.data());
+    for (size_t n : {text.size(), text.size() / 2, text.size() / 3, (size_t) 17, (size_t) 16, (size_t) 15}) {
+      n = std::min(n, text.size());
+      CHECK(scalar.text_length(s, n) == best.text_length(s, n), "round %d: text_length differs", round);
+      bool valid = scalar.validate(s, n);
+      CHECK(valid == best.validate(s, n), "round %d: validate differs for %zu bytes", round, n);
+      if (valid) {
+        out_scalar.assign(n, 0);
+        out_best.assign(n, 0);
+        size_t k = scalar.decode_valid(s, n, out_scalar.data());
+        CHECK(k == best.decode_valid(s, n, out_best.data()) && out_scalar == out_best,
+              "round %d: decode_valid differs", round);
+      }
+    }
+  }
+}
+
+int main() {
+  std::mt19937 rng(12345);
+  test_split_fuzz(rng);
+  test_kernels(rng);
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}